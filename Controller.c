@@ -38,6 +38,25 @@
 #include "StateServer.h"
 #include "RosSetupValidation.h"
 
+// Define ROS_SYS_TIMESTAMP to use the timestamp timer of the BSP for sub-tick
+// resolution of the controller clock (only if the BSP of the controller exports it)
+#ifdef ROS_SYS_TIMESTAMP
+extern UINT32 sysTimestamp(void);		/* VxWorks timestamp timer (restarted at each system clock tick) */
+extern UINT32 sysTimestampFreq(void);
+extern UINT32 sysTimestampPeriod(void);
+#endif
+
+extern int intLock(void);				/* VxWorks interrupt lock (intArchLib) */
+extern void intUnlock(int lockKey);
+
+// Controller clock (Ros_Controller_GetTime)
+ULONG clockTicksPerSec;			// System clock ticks per second
+double clockUsecPerTimestamp;	// Microseconds per count of the timestamp timer (0 = tick resolution only)
+// Clock state, only accessed with the interrupts locked
+ULONG clockLastTick;			// Tick count at the last call
+UINT32 clockTickWraps;			// Number of times the 32 bit tick count wrapped around
+UINT32 clockLastSubTickUsec;	// Sub-tick time returned at the last call (the clock never goes backwards)
+
 extern STATUS setsockopt
     (
     int    s,                 /* target socket */
@@ -52,8 +71,11 @@ extern STATUS setsockopt
 //-----------------------
 BOOL Ros_Controller_Init(Controller* controller);
 BOOL Ros_Controller_WaitInitReady(Controller* controller);
+void Ros_Controller_ClockInit();
 BOOL Ros_Controller_IsValidGroupNo(Controller* controller, int groupNo);
+BOOL Ros_Controller_IsConnectedAddr(Controller* controller, struct sockaddr_in* addr);
 int Ros_Controller_OpenSocket(int tcpPort);
+int Ros_Controller_OpenUdpSocket(int udpPort);
 void Ros_Controller_ConnectionServer_Start(Controller* controller);
 // Status related
 void Ros_Controller_StatusInit(Controller* controller);
@@ -71,6 +93,12 @@ int Ros_Controller_GetNotReadySubcode(Controller* controller);
 int Ros_Controller_StatusToMsg(Controller* controller, SimpleMsg* sendMsg);
 BOOL Ros_Controller_StatusRead(Controller* controller, USHORT ioStatus[IO_ROBOTSTATUS_MAX]);
 BOOL Ros_Controller_StatusUpdate(Controller* controller);
+void Ros_Controller_StatusWordUpdate(Controller* controller);
+void Ros_Controller_PostStatusEvent(Controller* controller, int signal, int value);
+BOOL Ros_Controller_GetStatusEvent(Controller* controller, SmBodyMotoStatusEvent* event);
+void Ros_Controller_LagSignalUpdate(Controller* controller);
+BOOL Ros_Controller_IsFeedbackSnapshotValid(Controller* controller);
+void Ros_Controller_ReadFeedback(Controller* controller, FeedbackSample* samples[MP_GRP_NUM]);
 // Wrapper around MPFunctions
 BOOL Ros_Controller_GetIOState(ULONG signal);
 void Ros_Controller_SetIOState(ULONG signal, BOOL status);
@@ -179,7 +207,7 @@ BOOL Ros_Controller_Init(Controller* controller)
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_0, FALSE);
 	Ros_Controller_SetIOState(IO_FEEDBACK_FAILURE, FALSE);
 	
-	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_1, FALSE);
+	Ros_Controller_SetIOState(IO_FEEDBACK_REALTIME_LAG, FALSE);
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_2, FALSE);
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_3, FALSE);
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_4, FALSE);
@@ -188,13 +216,31 @@ BOOL Ros_Controller_Init(Controller* controller)
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_7, FALSE);
 	Ros_Controller_SetIOState(IO_FEEDBACK_RESERVED_8, FALSE);
 	
+	Ros_Controller_ClockInit();
+
 	// Init variables and controller status
 	bInitOk = TRUE;
 	controller->bRobotJobReady = FALSE;
 	controller->bRobotJobReadyRaised = FALSE;
 	controller->bStopMotion = FALSE;
+	controller->speedScale = 1.0f;
+	controller->speedScaleStart = 1.0f;
+	controller->speedScaleTarget = 1.0f;
+	controller->speedScaleRamp = 1.0f;
+	controller->speedScaleRampStep = 0.0f;
+	controller->bRideThrough = FALSE;
+	controller->bRideThroughActive = FALSE;
+	controller->rideThroughMargin_ms = RIDE_THROUGH_MARGIN;
+	controller->startThreshold_ms = MOTION_START_THRESHOLD;
+	controller->lagCycleThreshold_ms = LAG_CYCLE_THRESHOLD;
+	controller->lagQueueThreshold_ms = LAG_QUEUE_THRESHOLD;
+	controller->lagCntReported = 0;
+	controller->lagSignalHold = 0;
+	Ros_MotionServer_ResetLagStats(controller);
+	controller->statusWordLock = mpSemBCreate(SEM_Q_FIFO, SEM_FULL);
 	Ros_Controller_StatusInit(controller);
 	Ros_Controller_StatusRead(controller, controller->ioStatus);
+	Ros_Controller_StatusWordUpdate(controller);
 	
 	// wait for controller to be ready for reading parameter
 	Ros_Controller_WaitInitReady(controller);
@@ -258,18 +304,64 @@ BOOL Ros_Controller_Init(Controller* controller)
 	for (i = 0; i < MAX_STATE_CONNECTIONS; i++)
 	{
 		controller->sdStateConnections[i] = INVALID_SOCKET;
+		controller->stateClientAddr[i] = 0;
+		controller->stateDecimation[i] = 0;
+		controller->stateFormat[i] = ROS_STATE_FORMAT_STANDARD;
+		controller->stateGroupMask[i] = STATE_GROUP_MASK_ALL;
+		controller->stateFieldMask[i] = ROS_STATE_FIELD_ALL;
+		controller->stateSendQ[i] = NULL;
+		controller->stateLastCycle[i] = 0;
+	}
+
+	controller->sdStateUdp = INVALID_SOCKET;
+	for (i = 0; i < MAX_UDP_STATE_CLIENTS; i++)
+	{
+		controller->bUdpStateClient[i] = FALSE;
+		controller->udpStateDecimation[i] = 0;
+		controller->udpStateLastCycle[i] = 0;
+		controller->udpStateSequence[i] = 0;
+		controller->udpStateRegTick[i] = 0;
+	}
+
+	controller->fbSnapshotSeq = 0;
+	controller->fbSnapshotCycle = 0;
+	controller->fbSnapshotTick = 0;
+	controller->semFbSnapshot = mpSemBCreate(SEM_Q_FIFO, SEM_EMPTY);
+
+	controller->statusEventLock = mpSemBCreate(SEM_Q_FIFO, SEM_FULL);
+	controller->semStatusEvent = mpSemBCreate(SEM_Q_FIFO, SEM_EMPTY);
+	controller->statusEventCnt = 0;
+	controller->statusEventSent = 0;
+
+	controller->ioCacheLock = mpSemBCreate(SEM_Q_FIFO, SEM_FULL);
+	controller->ioCacheCnt = 0;
+
+	controller->tidIoMonitor = INVALID_TASK;
+	controller->ioSubLock = mpSemBCreate(SEM_Q_FIFO, SEM_FULL);
+	for (i = 0; i < MAX_STATE_CONNECTIONS; i++)
+	{
+		controller->ioSubPeriod[i] = 0;
+		controller->ioSubNum[i] = 0;
+		controller->bIoSubSampled[i] = FALSE;
+		controller->ioSubLastTick[i] = 0;
+		controller->ioChangeCnt[i] = 0;
+		controller->ioChangeSent[i] = 0;
 	}
 
 	for (i = 0; i < MAX_MOTION_CONNECTIONS; i++)
 	{
 		controller->sdMotionConnections[i] = INVALID_SOCKET;
+		controller->motionClientAddr[i] = 0;
 		controller->tidMotionConnections[i] = INVALID_TASK;
 	}
 	controller->tidIncMoveThread = INVALID_TASK;
 
+	Ros_MotionServer_TraceInit(controller);
+
 #ifdef DX100
 	controller->bSkillMotionReady[0] = FALSE;
 	controller->bSkillMotionReady[1] = FALSE;
+	Ros_Controller_StatusWordUpdate(controller);
 #endif
 
 	if(bInitOk)
@@ -297,6 +389,7 @@ BOOL Ros_Controller_WaitInitReady(Controller* controller)
 		puts("Waiting for robot alarms to clear...");
 		Ros_Sleep(2500);
 		Ros_Controller_StatusRead(controller, controller->ioStatus);
+		Ros_Controller_StatusWordUpdate(controller);
 
 	}while(Ros_Controller_IsAlarm(controller));
 
@@ -319,6 +412,28 @@ BOOL Ros_Controller_IsValidGroupNo(Controller* controller, int groupNo)
 }
 
 
+//-------------------------------------------------------------------
+// Check if a state or motion TCP connection is open with the host of
+// the address (datagrams are only answered to connected hosts)
+//-------------------------------------------------------------------
+BOOL Ros_Controller_IsConnectedAddr(Controller* controller, struct sockaddr_in* addr)
+{
+	int i;
+
+	for(i = 0; i < MAX_STATE_CONNECTIONS; i++)
+	{
+		if(controller->sdStateConnections[i] != INVALID_SOCKET && controller->stateClientAddr[i] == addr->sin_addr.s_addr)
+			return TRUE;
+	}
+	for(i = 0; i < MAX_MOTION_CONNECTIONS; i++)
+	{
+		if(controller->sdMotionConnections[i] != INVALID_SOCKET && controller->motionClientAddr[i] == addr->sin_addr.s_addr)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+
 //-------------------------------------------------------------------
 // Open a socket to listen for incomming connection on specified port
 // return: <0  : Error
@@ -363,13 +478,48 @@ closeSockHandle:
 }
 
 
+//-------------------------------------------------------------------
+// Open a datagram socket bound to the specified port
+// return: <0  : Error
+// 		   >=0 : socket descriptor
+//-------------------------------------------------------------------
+int Ros_Controller_OpenUdpSocket(int udpPort)
+{
+	int sd;  // socket descriptor
+	struct sockaddr_in	serverSockAddr;
+
+	// Open the socket
+	sd = mpSocket(AF_INET, SOCK_DGRAM, 0);
+	if (sd < 0)
+		return -1;
+
+	// Set structure
+	memset(&serverSockAddr, 0, sizeof(struct sockaddr_in));
+	serverSockAddr.sin_family = AF_INET;
+	serverSockAddr.sin_addr.s_addr = INADDR_ANY;
+	serverSockAddr.sin_port = mpHtons(udpPort);
+
+	//bind to network interface
+	if (mpBind(sd, (struct sockaddr *)&serverSockAddr, sizeof(struct sockaddr_in)) < 0)
+	{
+		printf("Error in Ros_Controller_OpenUdpSocket\r\n");
+		mpClose(sd);
+		return -2;
+	}
+
+	return sd;
+}
+
+
 //-----------------------------------------------------------------------
 // Main Connection Server Task that listens for new connections
+// (and for the registration datagrams of the UDP state clients)
 //-----------------------------------------------------------------------
 void Ros_Controller_ConnectionServer_Start(Controller* controller)
 {
 	int     sdMotionServer = INVALID_SOCKET;
 	int     sdStateServer = INVALID_SOCKET;
+	int     sdMax;
 	struct  fd_set  fds;
 	int     sdAccepted = INVALID_SOCKET;
 	struct  sockaddr_in     clientSockAddr;
@@ -391,14 +541,35 @@ void Ros_Controller_ConnectionServer_Start(Controller* controller)
 	if(sdStateServer < 0)
 		goto closeSockHandle;
 
+	// UDP state streaming is optional
+	controller->sdStateUdp = Ros_Controller_OpenUdpSocket(UDP_PORT_STATE);
+	if(controller->sdStateUdp < 0)
+	{
+		printf("UDP state streaming not available\r\n");
+		controller->sdStateUdp = INVALID_SOCKET;
+	}
+
 	FOREVER //Continue to accept multiple connections forever
 	{
 		FD_ZERO(&fds);
 		FD_SET(sdMotionServer, &fds); 
 		FD_SET(sdStateServer, &fds); 
+		sdMax = max(sdMotionServer, sdStateServer);
+		if(controller->sdStateUdp != INVALID_SOCKET)
+		{
+			FD_SET(controller->sdStateUdp, &fds);
+			sdMax = max(sdMax, controller->sdStateUdp);
+		}
 		
-		if(mpSelect(sdStateServer+1, &fds, NULL, NULL, NULL) > 0)
+		if(mpSelect(sdMax+1, &fds, NULL, NULL, NULL) > 0)
 		{
+			if(controller->sdStateUdp != INVALID_SOCKET && FD_ISSET(controller->sdStateUdp, &fds))
+			{
+				Ros_StateServer_ReceiveUdpMsg(controller);
+				if(!FD_ISSET(sdMotionServer, &fds) && !FD_ISSET(sdStateServer, &fds))
+					continue;
+			}
+
 			memset(&clientSockAddr, 0, sizeof(clientSockAddr));
 			sizeofSockAddr = sizeof(clientSockAddr);
 			
@@ -422,9 +593,9 @@ void Ros_Controller_ConnectionServer_Start(Controller* controller)
 			}
 			
 			if(FD_ISSET(sdMotionServer, &fds))
-				Ros_MotionServer_StartNewConnection(controller, sdAccepted);
+				Ros_MotionServer_StartNewConnection(controller, sdAccepted, clientSockAddr.sin_addr.s_addr);
 			else if(FD_ISSET(sdStateServer, &fds))
-				Ros_StateServer_StartNewConnection(controller, sdAccepted);
+				Ros_StateServer_StartNewConnection(controller, sdAccepted, clientSockAddr.sin_addr.s_addr);
 			else
 				mpClose(sdAccepted);
 		}
@@ -437,6 +608,11 @@ closeSockHandle:
 		mpClose(sdMotionServer);
 	if(sdStateServer >= 0)
 		mpClose(sdStateServer);
+	if(controller->sdStateUdp != INVALID_SOCKET)
+	{
+		mpClose(controller->sdStateUdp);
+		controller->sdStateUdp = INVALID_SOCKET;
+	}
 
 	//disable feedback signal
 	Ros_Controller_SetIOState(IO_FEEDBACK_CONNECTSERVERRUNNING, FALSE);
@@ -471,125 +647,147 @@ void Ros_Controller_StatusInit(Controller* controller)
 }
 
 
+//-------------------------------------------------------------------
+// Rebuild the packed status word from the I/O status and job flags.
+// Must be called by the writer after any of them changes; the word is
+// published with a single store so readers always see a consistent set.
+// The writers are different tasks (status update, skill listener): the
+// rebuilds are serialized so the last store is built from the latest
+// values (a preempted writer can't publish a stale word afterward).
+//-------------------------------------------------------------------
+void Ros_Controller_StatusWordUpdate(Controller* controller)
+{
+	UINT32 word = 0;
+	int subcode;
+	int i;
+
+	mpSemTake(controller->statusWordLock, WAIT_FOREVER);
+
+	for(i=0; i<IO_ROBOTSTATUS_MAX; i++)
+	{
+		if(controller->ioStatus[i] != 0)
+			word |= STATUS_WORD_SIGNAL(i);
+	}
+
+	if(word & (STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ALARM_MAJOR) | STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ALARM_MINOR)
+		| STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ALARM_SYSTEM) | STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ALARM_USER)))
+		word |= STATUS_WORD_ALARM;
+
+	// E-stop signals are active low
+	if((word & (STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_EX) | STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_PP)
+		| STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_CTRL)))
+		!= (STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_EX) | STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_PP)
+		| STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ESTOP_CTRL)))
+		word |= STATUS_WORD_ESTOP;
+
+	if((word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_SERVO)) && !(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_INECOMODE)))
+		word |= STATUS_WORD_SERVO_ON;
+
+#ifdef DX100
+	if(controller->bRobotJobReady && controller->bSkillMotionReady[0]
+		&& (controller->numRobot < 2 || controller->bSkillMotionReady[1]))
+		word |= STATUS_WORD_MOTION_READY;
+#else
+	if(controller->bRobotJobReady)
+		word |= STATUS_WORD_MOTION_READY;
+#endif
+
+	// Precompute the reason why motion is refused
+	if(word & STATUS_WORD_ALARM)
+		subcode = ROS_RESULT_NOT_READY_ALARM;
+	else if(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ERROR))
+		subcode = ROS_RESULT_NOT_READY_ERROR;
+	else if(word & STATUS_WORD_ESTOP)
+		subcode = ROS_RESULT_NOT_READY_ESTOP;
+	else if(!(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_PLAY)))
+		subcode = ROS_RESULT_NOT_READY_NOT_PLAY;
+#ifndef DUMMY_SERVO_MODE
+	else if(!(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_REMOTE)))
+		subcode = ROS_RESULT_NOT_READY_NOT_REMOTE;
+	else if(!(word & STATUS_WORD_SERVO_ON))
+		subcode = ROS_RESULT_NOT_READY_SERVO_OFF;
+#endif
+	else if(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_HOLD))
+		subcode = ROS_RESULT_NOT_READY_HOLD;
+	else if(!(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_OPERATING)))
+		subcode = ROS_RESULT_NOT_READY_NOT_STARTED;
+	else if(!(word & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_WAITING_ROS)))
+		subcode = ROS_RESULT_NOT_READY_WAITING_ROS;
+	else if(!(word & STATUS_WORD_MOTION_READY))
+		subcode = ROS_RESULT_NOT_READY_SKILLSEND;
+	else
+		subcode = ROS_RESULT_NOT_READY_UNSPECIFIED;
+	word |= ((UINT32)(subcode - ROS_RESULT_NOT_READY_UNSPECIFIED) << STATUS_WORD_SUBCODE_SHIFT) & STATUS_WORD_SUBCODE_MASK;
+
+	controller->statusWord = word;
+
+	mpSemGive(controller->statusWordLock);
+}
+
 BOOL Ros_Controller_IsAlarm(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_ALARM_MAJOR]!=0) 
-		|| (controller->ioStatus[IO_ROBOTSTATUS_ALARM_MINOR]!=0)
-		|| (controller->ioStatus[IO_ROBOTSTATUS_ALARM_SYSTEM]!=0)
-		|| (controller->ioStatus[IO_ROBOTSTATUS_ALARM_USER]!=0) );
+	return ((controller->statusWord & STATUS_WORD_ALARM) != 0);
 }
 
 BOOL Ros_Controller_IsError(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_ERROR]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_ERROR)) != 0);
 }
 
 BOOL Ros_Controller_IsPlay(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_PLAY]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_PLAY)) != 0);
 }
 
 BOOL Ros_Controller_IsTeach(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_TEACH]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_TEACH)) != 0);
 }
 
 BOOL Ros_Controller_IsRemote(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_REMOTE]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_REMOTE)) != 0);
 }
 
 BOOL Ros_Controller_IsOperating(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_OPERATING]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_OPERATING)) != 0);
 }
 
 BOOL Ros_Controller_IsHold(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_HOLD]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_HOLD)) != 0);
 }
 
 BOOL Ros_Controller_IsServoOn(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_SERVO] != 0) && (controller->ioStatus[IO_ROBOTSTATUS_INECOMODE] == 0));
+	return ((controller->statusWord & STATUS_WORD_SERVO_ON) != 0);
 }
 
 BOOL Ros_Controller_IsEcoMode(Controller* controller)
 {
-	return (controller->ioStatus[IO_ROBOTSTATUS_INECOMODE] != 0);
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_INECOMODE)) != 0);
 }
 
 BOOL Ros_Controller_IsEStop(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_ESTOP_EX]==0) 
-		|| (controller->ioStatus[IO_ROBOTSTATUS_ESTOP_PP]==0)
-		|| (controller->ioStatus[IO_ROBOTSTATUS_ESTOP_CTRL]==0) );
+	return ((controller->statusWord & STATUS_WORD_ESTOP) != 0);
 }
 
 BOOL Ros_Controller_IsWaitingRos(Controller* controller)
 {
-	return ((controller->ioStatus[IO_ROBOTSTATUS_WAITING_ROS]!=0));
+	return ((controller->statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_WAITING_ROS)) != 0);
 }
 
 BOOL Ros_Controller_IsMotionReady(Controller* controller)
 {
-#ifdef DX100
-	if(controller->numRobot < 2)
-		return (controller->bRobotJobReady && controller->bSkillMotionReady[0]);
-	else
-	{
-		return (controller->bRobotJobReady && controller->bSkillMotionReady[0] && controller->bSkillMotionReady[1]);
-	}
-#else
-	return (controller->bRobotJobReady);
-#endif
+	return ((controller->statusWord & STATUS_WORD_MOTION_READY) != 0);
 }
 
 int Ros_Controller_GetNotReadySubcode(Controller* controller)
 {
-	// Check alarm
-	if(Ros_Controller_IsAlarm(controller))
-		return ROS_RESULT_NOT_READY_ALARM;
-	
-	// Check error
-	if(Ros_Controller_IsError(controller))
-		return ROS_RESULT_NOT_READY_ERROR;
-	
-	// Check e-stop
-	if(Ros_Controller_IsEStop(controller))
-		return ROS_RESULT_NOT_READY_ESTOP;
-
-	// Check play mode
-	if(!Ros_Controller_IsPlay(controller))
-		return ROS_RESULT_NOT_READY_NOT_PLAY;
-	
-#ifndef DUMMY_SERVO_MODE
-	// Check remote
-	if(!Ros_Controller_IsRemote(controller))
-		return ROS_RESULT_NOT_READY_NOT_REMOTE;
-	
-	// Check servo power
-	if(!Ros_Controller_IsServoOn(controller))
-		return ROS_RESULT_NOT_READY_SERVO_OFF;
-#endif
-
-	// Check hold
-	if(Ros_Controller_IsHold(controller))
-		return ROS_RESULT_NOT_READY_HOLD;
-
-	// Check operating
-	if(!Ros_Controller_IsOperating(controller))
-		return ROS_RESULT_NOT_READY_NOT_STARTED;
-	
-	// Check ready I/O signal (should confirm wait)
-	if(!Ros_Controller_IsWaitingRos(controller))
-		return ROS_RESULT_NOT_READY_WAITING_ROS;
-
-	// Check skill send command
-	if(!Ros_Controller_IsMotionReady(controller))
-		return ROS_RESULT_NOT_READY_SKILLSEND;
-		
-	return ROS_RESULT_NOT_READY_UNSPECIFIED;
+	return ROS_RESULT_NOT_READY_UNSPECIFIED
+		+ (int)((controller->statusWord & STATUS_WORD_SUBCODE_MASK) >> STATUS_WORD_SUBCODE_SHIFT);
 }
 
 
@@ -597,6 +795,8 @@ int Ros_Controller_GetNotReadySubcode(Controller* controller)
 // Simple message containing the current state of the controller
 int Ros_Controller_StatusToMsg(Controller* controller, SimpleMsg* sendMsg)
 {
+	UINT32 statusWord;
+
 	//initialize memory
 	memset(sendMsg, 0x00, sizeof(SimpleMsg));
 	
@@ -608,23 +808,24 @@ int Ros_Controller_StatusToMsg(Controller* controller, SimpleMsg* sendMsg)
 	sendMsg->header.commType = ROS_COMM_TOPIC;
 	sendMsg->header.replyType = ROS_REPLY_INVALID;
 	
-	// set body
-	sendMsg->body.robotStatus.drives_powered = (int)(Ros_Controller_IsServoOn(controller));
-	sendMsg->body.robotStatus.e_stopped = (int)(Ros_Controller_IsEStop(controller));
+	// set body (from a single read of the status word so that all fields are consistent)
+	statusWord = controller->statusWord;
+	sendMsg->body.robotStatus.drives_powered = (int)((statusWord & STATUS_WORD_SERVO_ON) != 0);
+	sendMsg->body.robotStatus.e_stopped = (int)((statusWord & STATUS_WORD_ESTOP) != 0);
 	sendMsg->body.robotStatus.error_code = controller->alarmCode;
-	sendMsg->body.robotStatus.in_error = (int)Ros_Controller_IsAlarm(controller);
+	sendMsg->body.robotStatus.in_error = (int)((statusWord & STATUS_WORD_ALARM) != 0);
 	sendMsg->body.robotStatus.in_motion = (int)(Ros_MotionServer_HasDataInQueue(controller));
     //Ros_Controller_IsOperating
     //Ros_Controller_IsHold
-	if(Ros_Controller_IsPlay(controller))
+	if(statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_PLAY))
 		sendMsg->body.robotStatus.mode = 2;
 	else
 		sendMsg->body.robotStatus.mode = 1;
 
     // need to know if in REMOTE mode since otherwise robot will not move
-	if(Ros_Controller_IsRemote(controller))
+	if(statusWord & STATUS_WORD_SIGNAL(IO_ROBOTSTATUS_REMOTE))
 		sendMsg->body.robotStatus.mode += 4;
-	sendMsg->body.robotStatus.motion_possible = (int)(Ros_Controller_IsMotionReady(controller));
+	sendMsg->body.robotStatus.motion_possible = (int)((statusWord & STATUS_WORD_MOTION_READY) != 0);
 	
 	return(sendMsg->prefix.length + sizeof(SmPrefix));
 }
@@ -645,6 +846,8 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 	USHORT ioStatus[IO_ROBOTSTATUS_MAX];
 	int i;
 	
+	Ros_Controller_LagSignalUpdate(controller);
+	
 	if(Ros_Controller_StatusRead(controller, ioStatus))
 	{
 		// Check for change of state and potentially react to the change
@@ -655,6 +858,7 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 				//printf("Change of ioStatus[%d]\r\n", i);
 				
 				controller->ioStatus[i] = ioStatus[i];
+				Ros_Controller_StatusWordUpdate(controller);
 				switch(i)
 				{
 					case IO_ROBOTSTATUS_ALARM_MAJOR: // alarm
@@ -682,6 +886,7 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 							// Job execution stopped take action
 							controller->bRobotJobReady = FALSE;
 							controller->bRobotJobReadyRaised = FALSE;
+							Ros_Controller_StatusWordUpdate(controller);
 							Ros_MotionServer_ClearQ_All(controller);
 						}
 						else // signal turned ON
@@ -699,6 +904,7 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 #endif
 							{
 								controller->bRobotJobReady = TRUE;
+								Ros_Controller_StatusWordUpdate(controller);
 								if(Ros_Controller_IsMotionReady(controller))
 									printf("Robot job is ready for ROS commands.\r\n");
 							}
@@ -706,6 +912,9 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 						break;
 					}
 				}
+
+				// Notify the state server clients
+				Ros_Controller_PostStatusEvent(controller, i, ioStatus[i]);
 			}
 		}
 		return TRUE;
@@ -714,6 +923,216 @@ BOOL Ros_Controller_StatusUpdate(Controller* controller)
 }
 
 
+//-------------------------------------------------------------------
+// Add a status change to the event queue and wake up the state server
+// (the oldest event is overwritten when the queue is full)
+//-------------------------------------------------------------------
+void Ros_Controller_PostStatusEvent(Controller* controller, int signal, int value)
+{
+	SmBodyMotoStatusEvent* event;
+
+	if(mpSemTake(controller->statusEventLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+	{
+		printf("ERROR: Unable to post the status event (signal %d)\r\n", signal);
+		return;
+	}
+
+	event = &controller->statusEvent[controller->statusEventCnt % STATUS_EVENT_QUEUE_SIZE];
+	event->sequence = controller->statusEventCnt + 1;
+	Ros_Controller_GetTime(&event->time);
+	event->signal = signal;
+	event->value = value;
+	event->alarmCode = controller->alarmCode;
+	controller->statusEventCnt++;
+
+	mpSemGive(controller->statusEventLock);
+	mpSemGive(controller->semStatusEvent);
+}
+
+
+//-------------------------------------------------------------------
+// Get the next status event not processed by the state server
+// return FALSE if there is no new event
+//-------------------------------------------------------------------
+BOOL Ros_Controller_GetStatusEvent(Controller* controller, SmBodyMotoStatusEvent* event)
+{
+	BOOL bNewEvent = FALSE;
+
+	if(mpSemTake(controller->statusEventLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+		return FALSE;
+
+	if(controller->statusEventSent != controller->statusEventCnt)
+	{
+		// Skip the events that were overwritten
+		if(controller->statusEventCnt - controller->statusEventSent > STATUS_EVENT_QUEUE_SIZE)
+			controller->statusEventSent = controller->statusEventCnt - STATUS_EVENT_QUEUE_SIZE;
+
+		*event = controller->statusEvent[controller->statusEventSent % STATUS_EVENT_QUEUE_SIZE];
+		controller->statusEventSent++;
+		bNewEvent = TRUE;
+	}
+
+	mpSemGive(controller->statusEventLock);
+	return bNewEvent;
+}
+
+
+//-------------------------------------------------------------------
+// Read the feedback of all groups.  mpSvsGetVelTrqFb returns the servo
+// speed and torque of every group: it is called once for all of them.
+//-------------------------------------------------------------------
+void Ros_Controller_ReadFeedback(Controller* controller, FeedbackSample* samples[MP_GRP_NUM])
+{
+	MP_GRP_AXES_T dst_vel;
+	MP_TRQ_CTL_VAL dst_trq;
+	BOOL bServoValid;
+	int groupNo;
+
+	memset(dst_trq.data, 0, sizeof(MP_TRQCTL_DATA));
+	dst_trq.unit = TRQ_NEWTON_METER; //request data in Nm
+	bServoValid = (mpSvsGetVelTrqFb(dst_vel, &dst_trq) == OK);
+
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		Ros_CtrlGroup_ReadFeedbackPos(controller->ctrlGroups[groupNo], samples[groupNo]);
+
+		if(bServoValid)
+			Ros_CtrlGroup_ExtractServoSpeedTorque(controller->ctrlGroups[groupNo], dst_vel, &dst_trq, 
+												samples[groupNo]->pulseSpeed, samples[groupNo]->torque);
+		else
+		{
+			memset(samples[groupNo]->pulseSpeed, 0, sizeof(samples[groupNo]->pulseSpeed));
+			memset(samples[groupNo]->torque, 0, sizeof(samples[groupNo]->torque));
+		}
+		samples[groupNo]->bSpeedValid = bServoValid;
+		samples[groupNo]->bTorqueValid = bServoValid;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Sample the feedback (position, command position, servo speed and
+// torque) of all groups into the snapshot once per interpolation cycle
+// (IP task)
+// Readers use Ros_Controller_GetFeedbackSnapshot/GetFeedbackSample.
+// The snapshot is protected by a sequence count: the readers retry the
+// copy if fbSnapshotSeq was odd or changed meanwhile.  This relies on all
+// the tasks running on a single core (program order is the order seen by
+// the other tasks), so only compiler barriers are needed around the copy.
+//-------------------------------------------------------------------
+void Ros_Controller_SampleFeedback(Controller* controller)
+{
+	FeedbackSample* snapshots[MP_GRP_NUM];
+	int groupNo;
+
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+		snapshots[groupNo] = &controller->ctrlGroups[groupNo]->fbSnapshot;
+
+	controller->fbSnapshotSeq++;	// odd: update in progress
+	ROS_COMPILER_BARRIER();
+	Ros_Controller_ReadFeedback(controller, snapshots);
+	controller->fbSnapshotCycle++;
+	controller->fbSnapshotTick = tickGet();
+	ROS_COMPILER_BARRIER();
+	controller->fbSnapshotSeq++;	// even: update complete
+
+	// Wake up the publishers
+	mpSemGive(controller->semFbSnapshot);
+}
+
+
+//-------------------------------------------------------------------
+// Check if the IP task is updating the feedback snapshot
+//-------------------------------------------------------------------
+BOOL Ros_Controller_IsFeedbackSnapshotValid(Controller* controller)
+{
+	return ((controller->fbSnapshotCycle != 0)
+		&& ((tickGet() - controller->fbSnapshotTick) * mpGetRtc() <= FEEDBACK_SNAPSHOT_MAX_AGE));
+}
+
+
+//-------------------------------------------------------------------
+// Copy the feedback snapshot of all groups.  The copy is retried if the
+// IP task updates the snapshot while it is being read.  The feedback is
+// read directly if the snapshot is stale.
+// Returns the cycle number of the snapshot
+//-------------------------------------------------------------------
+UINT32 Ros_Controller_GetFeedbackSnapshot(Controller* controller, FeedbackSample samples[MP_GRP_NUM])
+{
+	FeedbackSample* dst[MP_GRP_NUM];
+	UINT32 seq;
+	UINT32 cycle;
+	int groupNo;
+
+	if(!Ros_Controller_IsFeedbackSnapshotValid(controller))
+	{
+		for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+			dst[groupNo] = &samples[groupNo];
+		Ros_Controller_ReadFeedback(controller, dst);
+		return controller->fbSnapshotCycle;
+	}
+
+	do
+	{
+		seq = controller->fbSnapshotSeq;
+		ROS_COMPILER_BARRIER();	// copy after reading the sequence...
+		cycle = controller->fbSnapshotCycle;
+		for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+			samples[groupNo] = controller->ctrlGroups[groupNo]->fbSnapshot;
+		ROS_COMPILER_BARRIER();	// ...and before checking it again
+	} while((seq & 1) || (seq != controller->fbSnapshotSeq));
+
+	return cycle;
+}
+
+
+//-------------------------------------------------------------------
+// Copy the feedback snapshot of one group (see GetFeedbackSnapshot)
+// return: TRUE if the feedback position is valid
+//-------------------------------------------------------------------
+BOOL Ros_Controller_GetFeedbackSample(Controller* controller, int groupNo, FeedbackSample* sample)
+{
+	UINT32 seq;
+
+	if(!Ros_Controller_IsFeedbackSnapshotValid(controller))
+		return Ros_CtrlGroup_ReadFeedback(controller->ctrlGroups[groupNo], sample);
+
+	do
+	{
+		seq = controller->fbSnapshotSeq;
+		ROS_COMPILER_BARRIER();
+		*sample = controller->ctrlGroups[groupNo]->fbSnapshot;
+		ROS_COMPILER_BARRIER();
+	} while((seq & 1) || (seq != controller->fbSnapshotSeq));
+
+	return sample->bPosValid;
+}
+
+
+//-------------------------------------------------------------------
+// Raise IO_FEEDBACK_REALTIME_LAG when the IP task reports new lag events
+// and keep it ON for LAG_SIGNAL_HOLD_TIME after the last one
+//-------------------------------------------------------------------
+void Ros_Controller_LagSignalUpdate(Controller* controller)
+{
+	UINT32 lagCnt = controller->ipLateCycleCnt + controller->producerLagCnt;
+
+	if(lagCnt != controller->lagCntReported)
+	{
+		controller->lagCntReported = lagCnt;
+		if(controller->lagSignalHold == 0)
+			Ros_Controller_SetIOState(IO_FEEDBACK_REALTIME_LAG, TRUE);
+		controller->lagSignalHold = LAG_SIGNAL_HOLD_TIME / CONTROLLER_STATUS_UPDATE_PERIOD;
+	}
+	else if(controller->lagSignalHold > 0)
+	{
+		controller->lagSignalHold--;
+		if(controller->lagSignalHold == 0)
+			Ros_Controller_SetIOState(IO_FEEDBACK_REALTIME_LAG, FALSE);
+	}
+}
+
+
 
 /**** Wrappers on MP standard function ****/
 
@@ -753,6 +1172,114 @@ void Ros_Controller_SetIOState(ULONG signal, BOOL status)
 }
 
 
+//-------------------------------------------------------------------
+// Read an I/O address, accepting a value read up to maxAge_ms ago.
+// The value is taken from the IO cache when it is recent enough,
+// otherwise it is read and the address is added to the cache so that
+// the IP task refreshes it with the other cached addresses.
+// maxAge_ms <= 0: always read the I/O
+//-------------------------------------------------------------------
+BOOL Ros_Controller_ReadIOCached(Controller* controller, ULONG address, USHORT* value, int maxAge_ms)
+{
+	MP_IO_INFO ioInfo;
+	ULONG tick;
+	int index, lruIndex;
+	BOOL bRead;
+
+	ioInfo.ulAddr = address;
+	if(maxAge_ms <= 0)
+		return (mpReadIO(&ioInfo, value, 1) == OK);
+
+	if(mpSemTake(controller->ioCacheLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+		return (mpReadIO(&ioInfo, value, 1) == OK);
+
+	tick = tickGet();
+	lruIndex = 0;
+	for(index = 0; index < controller->ioCacheCnt; index++)
+	{
+		if(controller->ioCacheAddr[index].ulAddr == address)
+			break;
+		if((tick - controller->ioCacheUseTick[index]) > (tick - controller->ioCacheUseTick[lruIndex]))
+			lruIndex = index;
+	}
+
+	if(index < controller->ioCacheCnt && (tick - controller->ioCacheReadTick[index]) * mpGetRtc() <= maxAge_ms)
+	{
+		// Recent enough
+		*value = controller->ioCacheValue[index];
+		controller->ioCacheUseTick[index] = tick;
+		mpSemGive(controller->ioCacheLock);
+		return TRUE;
+	}
+
+	bRead = (mpReadIO(&ioInfo, value, 1) == OK);
+	if(bRead)
+	{
+		// New address: take a free entry or the least recently used one
+		if(index == controller->ioCacheCnt)
+		{
+			if(controller->ioCacheCnt < IO_CACHE_SIZE)
+				controller->ioCacheCnt++;
+			else
+				index = lruIndex;
+		}
+		controller->ioCacheAddr[index].ulAddr = address;
+		controller->ioCacheValue[index] = *value;
+		controller->ioCacheReadTick[index] = tick;
+		controller->ioCacheUseTick[index] = tick;
+	}
+
+	mpSemGive(controller->ioCacheLock);
+	return bRead;
+}
+
+
+//-------------------------------------------------------------------
+// Refresh the IO cache with a single mpReadIO call (IP task, once per
+// cycle).  The addresses that weren't requested for IO_CACHE_EXPIRE_TIME
+// are removed first.  Skipped if a reader holds the cache.
+//-------------------------------------------------------------------
+void Ros_Controller_RefreshIOCache(Controller* controller)
+{
+	USHORT ioValue[IO_CACHE_SIZE];
+	ULONG tick;
+	int index, cnt;
+
+	if(controller->ioCacheCnt == 0)
+		return;
+
+	if(mpSemTake(controller->ioCacheLock, NO_WAIT) != OK)
+		return;
+
+	tick = tickGet();
+	for(index = 0, cnt = 0; index < controller->ioCacheCnt; index++)
+	{
+		if((tick - controller->ioCacheUseTick[index]) * mpGetRtc() > IO_CACHE_EXPIRE_TIME)
+			continue;
+		if(cnt != index)
+		{
+			controller->ioCacheAddr[cnt] = controller->ioCacheAddr[index];
+			controller->ioCacheValue[cnt] = controller->ioCacheValue[index];
+			controller->ioCacheReadTick[cnt] = controller->ioCacheReadTick[index];
+			controller->ioCacheUseTick[cnt] = controller->ioCacheUseTick[index];
+		}
+		cnt++;
+	}
+	controller->ioCacheCnt = cnt;
+
+	if(cnt > 0 && mpReadIO(controller->ioCacheAddr, ioValue, cnt) == OK)
+	{
+		for(index = 0; index < cnt; index++)
+		{
+			controller->ioCacheValue[index] = ioValue[index];
+			controller->ioCacheReadTick[index] = tick;
+		}
+	}
+
+	mpSemGive(controller->ioCacheLock);
+}
+
+
 //-------------------------------------------------------------------
 // Get the code of the first alarm on the controller
 //-------------------------------------------------------------------
@@ -804,6 +1331,7 @@ void Ros_Controller_ListenForSkill(Controller* controller, int sl)
 	STATUS apiRet;
 	
 	controller->bSkillMotionReady[sl - MP_SL_ID1] = FALSE;
+	Ros_Controller_StatusWordUpdate(controller);
 	memset(&skillMsg, 0x00, sizeof(SYS2MP_SENS_MSG));
 	
 	FOREVER
@@ -845,6 +1373,7 @@ void Ros_Controller_ListenForSkill(Controller* controller, int sl)
 #ifdef DEBUG
 			printf("controller->bSkillMotionReady[%d] = %d\n", (sl - MP_SL_ID1), controller->bSkillMotionReady[sl - MP_SL_ID1]);
 #endif
+			Ros_Controller_StatusWordUpdate(controller);
 
 			if(Ros_Controller_IsMotionReady(controller))
 				printf("Robot job is ready for ROS commands.\r\n");
@@ -853,6 +1382,7 @@ void Ros_Controller_ListenForSkill(Controller* controller, int sl)
 		case MP_SKILL_END:
 			//ABORT!!!
 			controller->bSkillMotionReady[sl - MP_SL_ID1] = FALSE;
+			Ros_Controller_StatusWordUpdate(controller);
 			break;
 		}
 	}
@@ -932,3 +1462,133 @@ void Ros_Sleep(float milliseconds)
 {
 	mpTaskDelay(milliseconds / mpGetRtc()); //Tick length varies between controller models
 }
+
+
+//-------------------------------------------------------------------
+// Initialize the controller clock.  The timestamp timer is only used
+// if it runs over one system clock tick (sub-tick resolution).
+//-------------------------------------------------------------------
+void Ros_Controller_ClockInit()
+{
+#ifdef ROS_SYS_TIMESTAMP
+	UINT32 freq = sysTimestampFreq();
+	double periodUsec;
+#endif
+
+	clockTicksPerSec = 1000 / mpGetRtc();
+	clockUsecPerTimestamp = 0;
+	clockLastTick = tickGet();
+	clockTickWraps = 0;
+	clockLastSubTickUsec = 0;
+
+#ifdef ROS_SYS_TIMESTAMP
+	if(freq > 0)
+	{
+		periodUsec = ((double)sysTimestampPeriod() + 1) * 1000000.0 / freq;
+		if(periodUsec > mpGetRtc() * 990.0 && periodUsec < mpGetRtc() * 1010.0)
+			clockUsecPerTimestamp = 1000000.0 / freq;
+	}
+#endif
+
+	printf("Controller clock: %d ticks/sec, %s\r\n", (int)clockTicksPerSec, 
+		(clockUsecPerTimestamp > 0) ? "sub-tick resolution" : "tick resolution");
+}
+
+
+//-------------------------------------------------------------------
+// Get the controller time: time elapsed since the controller started,
+// with microsecond resolution when the timestamp timer is available.
+// Used to timestamp the feedback and for the clock synchronization.
+// Doesn't block: the clock state is updated with the interrupts locked
+// for a few instructions, so the IP task can call it every cycle.
+//-------------------------------------------------------------------
+void Ros_Controller_GetTime(RosTime* time)
+{
+	int lockKey;
+	ULONG tick;
+	UINT32 tickWraps;
+	double ticks;
+	UINT32 subTickUsec = 0;
+#ifdef ROS_SYS_TIMESTAMP
+	UINT32 timestamp;
+#endif
+
+	// The tick is read with the interrupts locked so the wrap around of
+	// the count is detected in order (and the tick can't change while
+	// the timestamp is read)
+	lockKey = intLock();
+
+	tick = tickGet();
+#ifdef ROS_SYS_TIMESTAMP
+	timestamp = sysTimestamp();
+#endif
+
+	if(tick < clockLastTick)
+		clockTickWraps++;
+
+#ifdef ROS_SYS_TIMESTAMP
+	if(clockUsecPerTimestamp > 0)
+	{
+		subTickUsec = min((UINT32)(timestamp * clockUsecPerTimestamp), (UINT32)(mpGetRtc() * 1000 - 1));
+
+		// A timestamp read after its rollover but before the tick is counted
+		// would go back by one tick: never return a time before the last one
+		if(tick == clockLastTick && subTickUsec < clockLastSubTickUsec)
+			subTickUsec = clockLastSubTickUsec;
+		clockLastSubTickUsec = subTickUsec;
+	}
+#endif
+
+	clockLastTick = tick;
+	tickWraps = clockTickWraps;
+
+	intUnlock(lockKey);
+
+	ticks = tickWraps * 4294967296.0 + tick;
+	time->sec = (UINT32)(ticks / clockTicksPerSec);
+	time->usec = (UINT32)(ticks - (double)time->sec * clockTicksPerSec) * mpGetRtc() * 1000 + subTickUsec;
+}
+
+
+//-------------------------------------------------------------------
+// Time (us) elapsed between two controller times.  Saturates to
+// +/-TIME_DIFF_MAX_US when the times are more than a second apart.
+//-------------------------------------------------------------------
+int Ros_Controller_TimeDiff(RosTime* startTime, RosTime* endTime)
+{
+	// Compare the seconds first so the difference can't overflow
+	if(endTime->sec == startTime->sec)
+		return (int)endTime->usec - (int)startTime->usec;
+	if(endTime->sec == startTime->sec + 1)
+		return 1000000 + ((int)endTime->usec - (int)startTime->usec);
+	if(startTime->sec == endTime->sec + 1)
+		return -1000000 + ((int)endTime->usec - (int)startTime->usec);
+	return (endTime->sec > startTime->sec) ? TIME_DIFF_MAX_US : -TIME_DIFF_MAX_US;
+}
+
+
+//-------------------------------------------------------------------
+// Creates the reply to a ROS_MSG_MOTO_CLOCK_SYNC request received at
+// receiveTime.  The transmit time is taken last, just before the
+// reply is sent.
+//-------------------------------------------------------------------
+int Ros_Controller_ClockSyncReply(SimpleMsg* receiveMsg, RosTime* receiveTime, SimpleMsg* replyMsg)
+{
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
+
+	// set prefix: length of message excluding the prefix
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoClockSync);
+
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_CLOCK_SYNC;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+	replyMsg->header.replyType = ROS_REPLY_SUCCESS;
+
+	// set body
+	replyMsg->body.clockSync.clientTime = receiveMsg->body.clockSync.clientTime;
+	replyMsg->body.clockSync.receiveTime = *receiveTime;
+	Ros_Controller_GetTime(&replyMsg->body.clockSync.transmitTime);
+
+	return(replyMsg->prefix.length + sizeof(SmPrefix));
+}
@@ -36,10 +36,17 @@
 #include "CtrlGroup.h"
 #include "SimpleMessage.h"
 
+extern ULONG tickGet(void);		/* VxWorks kernel tick counter (tickLib) */
+
+// Compiler barrier: memory accesses are not moved across it (no CPU fence,
+// the tasks of the application run on a single core)
+#define ROS_COMPILER_BARRIER()	__asm__ __volatile__("" : : : "memory")
+
 #define APPLICATION_VERSION					"1.5.0M"
 
 #define TCP_PORT_MOTION						50240
 #define TCP_PORT_STATE						50241
+#define UDP_PORT_STATE						50241
 
 #define IO_FEEDBACK_WAITING_MP_INCMOVE		11120  //output# 889 
 #define IO_FEEDBACK_MP_INCMOVE_DONE			11121  //output# 890 
@@ -50,7 +57,7 @@
 #define IO_FEEDBACK_RESERVED_0				11126  //output# 895 
 #define IO_FEEDBACK_FAILURE					11127  //output# 896
 
-#define IO_FEEDBACK_RESERVED_1				11130  //output# 897 
+#define IO_FEEDBACK_REALTIME_LAG			11130  //output# 897 
 #define IO_FEEDBACK_RESERVED_2				11131  //output# 898 
 #define IO_FEEDBACK_RESERVED_3				11132  //output# 899 
 #define IO_FEEDBACK_RESERVED_4				11133  //output# 900 
@@ -61,6 +68,13 @@
 
 #define MAX_MOTION_CONNECTIONS	1
 #define MAX_STATE_CONNECTIONS	4
+#define STATE_SEND_QUEUE_SIZE	16	// Maximum number of outgoing messages buffered for each state client
+#define STATE_SEND_BUFFER_SIZE	4096	// Bytes buffered for each state client (messages are stored with their actual size)
+#define STATE_REPLY_MAX_SIZE	(sizeof(SmPrefix) + sizeof(SmHeader) + sizeof(SmBodyMotoMotionReply))	// Replies of the state server
+#define MAX_UDP_STATE_CLIENTS	4
+#define STATE_GROUP_MASK_ALL	((1 << MOT_MAX_GR) - 1)
+
+#define TIME_DIFF_MAX_US		2000000000	// Saturated result of Ros_Controller_TimeDiff
 
 #define INVALID_SOCKET -1
 #define INVALID_TASK -1
@@ -75,6 +89,23 @@
 
 #define CONTROLLER_STATUS_UPDATE_PERIOD 10
 
+#define STATUS_EVENT_QUEUE_SIZE 32	// Status changes buffered until the state server pushes them
+#define IO_CACHE_SIZE 16				// Addresses kept in the IO read cache
+#define IO_CACHE_EXPIRE_TIME 1000		// Time (ms) after which an address that isn't read anymore leaves the cache
+#define IO_CHANGE_QUEUE_SIZE 16		// IO change messages buffered for each state client until the state server pushes them
+
+#define FEEDBACK_SNAPSHOT_MAX_AGE 20	// Time (ms) after which the feedback snapshot is considered stale (IP task not sampling)
+
+// Packed controller status word (Controller.statusWord), rebuilt every time the status changes
+// so that hot-path checks are a single load and mask
+#define STATUS_WORD_SIGNAL(i)			(1 << (i))	// Bits 0-15: ioStatus[i] != 0 (IoStatusIndex)
+#define STATUS_WORD_ALARM				0x00010000	// Any alarm signal active
+#define STATUS_WORD_ESTOP				0x00020000	// Any e-stop signal active
+#define STATUS_WORD_SERVO_ON			0x00040000	// Servo power on and not in energy saving mode
+#define STATUS_WORD_MOTION_READY		0x00080000	// Job ready for increment move (and SKILL active on DX100)
+#define STATUS_WORD_SUBCODE_SHIFT		20			// Bits 20-23: not-ready subcode - ROS_RESULT_NOT_READY_UNSPECIFIED
+#define STATUS_WORD_SUBCODE_MASK		0x00F00000
+
 #define MASK_ISALARM_ACTIVEALARM 0x02
 #define MASK_ISALARM_ACTIVEERROR 0x01
 
@@ -99,6 +130,36 @@ typedef enum
 	IO_ROBOTSTATUS_MAX
 } IoStatusIndex;
  
+// Outgoing messages of a state server client (oldest message dropped when full)
+// Each message is stored in one piece in buffer, after the previous one or at
+// the start of the buffer when it doesn't fit at the end.
+typedef struct
+{
+	int cnt;
+	int idx;
+	int dropCnt;								// Number of messages dropped since the connection
+	ULONG lastSendTick;							// Last time the client accepted a message (or the queue became non-empty)
+	int msgOffset[STATE_SEND_QUEUE_SIZE];		// Position of each message in buffer
+	int msgSize[STATE_SEND_QUEUE_SIZE];
+	UINT8 buffer[STATE_SEND_BUFFER_SIZE];
+	int sentBytes;								// Bytes of the message being sent already accepted by the socket
+	BOOL bSendingReply;							// The message being sent is the reply (not the oldest queued message)
+
+	// Reply to the last request of the client (never dropped, the next request is read once it is sent)
+	int replySize;								// 0 = no reply pending
+	UINT8 reply[STATE_REPLY_MAX_SIZE];
+
+	// Reference of the compact feedback (ROS_STATE_FORMAT_DELTA): values of the last message queued
+	UINT32 deltaSequence;						// Sequence number of the last message
+	int deltaKeyframeCnt;						// Messages queued since the last keyframe (-1 = next message is a keyframe)
+	int deltaDropCnt;							// dropCnt when the last message was queued
+	int deltaValidFields[MOT_MAX_GR];
+	INT32 deltaPos[MOT_MAX_GR][ROS_MAX_JOINT];
+	INT32 deltaVel[MOT_MAX_GR][ROS_MAX_JOINT];
+	INT32 deltaCmdPos[MOT_MAX_GR][ROS_MAX_JOINT];
+	SmBodyRobotStatus deltaStatus;				// Status last sent
+} StateSendQueue;
+ 
 typedef struct
 {
 	UINT16 interpolPeriod;									// Interpolation period of the controller
@@ -109,20 +170,106 @@ typedef struct
 	// Controller Status
 	MP_IO_INFO ioStatusAddr[IO_ROBOTSTATUS_MAX];			// Array of Specific Input Address representing the I/O status
 	USHORT ioStatus[IO_ROBOTSTATUS_MAX];					// Array storing the current status of the controller
+	volatile UINT32 statusWord;								// Packed status (STATUS_WORD_xxx) published as a single store
+	SEM_ID statusWordLock;									// Serializes the rebuilds of statusWord (Ros_Controller_StatusWordUpdate)
 	int alarmCode;											// Alarm number currently active
 	BOOL bRobotJobReady;									// Boolean indicating that the controller is ready for increment move
 	BOOL bRobotJobReadyRaised;								// Indicates that the signal was raised since operating was resumed
 	BOOL bStopMotion;										// Flag to stop motion
 
+	// Time scaling of the trajectory (controlled stop and resume)
+	float speedScale;										// Trajectory time elapsed per interpolation period (0.0=paused, 1.0=nominal)
+	float speedScaleStart;									// Scale at the beginning of the current ramp
+	float speedScaleTarget;									// Scale at the end of the current ramp
+	float speedScaleRamp;									// Progress of the current ramp (0.0 to 1.0)
+	float speedScaleRampStep;								// Ramp progress per interpolation period
+	BOOL bRideThrough;										// Slow down instead of running out of queued motion (set per motion connection)
+	BOOL bRideThroughActive;								// Motion is slowed down because the queued motion is running out
+	int rideThroughMargin_ms;								// Motion time left in the queue at the end of a ride-through deceleration
+
+	int startThreshold_ms;									// Motion time to buffer before a trajectory starts (set per motion connection)
+	BOOL bMotionReplyEx;									// Reply with ROS_MSG_MOTO_MOTION_REPLY_EX (set per motion connection)
+
+	// Real-time lag monitor (statistics updated by the IP task)
+	int lagCycleThreshold_ms;								// Delay or execution time of an IP cycle above which it is counted as late (0 = disabled)
+	int lagQueueThreshold_ms;								// Buffered motion time below which a group with pending data is counted as lagging (0 = disabled)
+	UINT32 ipCycleCnt;										// Number of cycles executed by the IP task
+	UINT32 ipLateCycleCnt;									// Number of IP cycles that started late or took too long to execute
+	int ipMaxCycleInterval_us;								// Longest time between the start of two IP cycles
+	int ipMaxExecTime_us;									// Longest execution time of an IP cycle
+	UINT32 producerLagCnt;									// Number of IP cycles where the interpolation of a pending point didn't keep up
+	int producerMinQueueTime_ms;							// Shortest buffered motion time while a point was pending (-1 = none)
+	UINT32 lagCntReported;									// Lag count reported on IO_FEEDBACK_REALTIME_LAG
+	int lagSignalHold;										// Remaining status updates with IO_FEEDBACK_REALTIME_LAG ON
+
+	// Trace of the IP cycles (Ros_MotionServer_TraceRecord)
+	UINT8* traceBuffer;										// TRACE_BUFFER_SIZE entries of traceEntrySize bytes (NULL = not available)
+	int traceEntrySize;										// SmMotoTraceEntry followed by one SmMotoTraceGroup per group
+	int traceIdx;											// Next entry written
+	int traceCnt;											// Number of entries recorded
+	SmTraceState traceState;
+	int tracePostTrigger;									// Cycles left to record after the trigger
+
+	// Status changes detected by Ros_Controller_StatusUpdate (pushed by the state server)
+	SEM_ID statusEventLock;									// Protects the event queue (status updated by several tasks)
+	SEM_ID semStatusEvent;									// Given when an event is posted
+	UINT32 statusEventCnt;									// Number of events posted (next entry: statusEventCnt % STATUS_EVENT_QUEUE_SIZE)
+	UINT32 statusEventSent;									// Number of events processed by the state server
+	SmBodyMotoStatusEvent statusEvent[STATUS_EVENT_QUEUE_SIZE];
+
+	// IO read cache (Ros_Controller_ReadIOCached): addresses read recently, refreshed by the IP task
+	SEM_ID ioCacheLock;										// Protects the cache (the IP task skips the refresh when busy)
+	int ioCacheCnt;											// Number of addresses in the cache
+	MP_IO_INFO ioCacheAddr[IO_CACHE_SIZE];
+	USHORT ioCacheValue[IO_CACHE_SIZE];
+	ULONG ioCacheReadTick[IO_CACHE_SIZE];					// Time the value was read
+	ULONG ioCacheUseTick[IO_CACHE_SIZE];					// Last time the address was requested (expires after IO_CACHE_EXPIRE_TIME)
+
+	// IO monitored for the state clients (ROS_MSG_MOTO_IO_SUBSCRIBE), sampled by the IO monitor task
+	int tidIoMonitor;										// ThreadId of the IO monitor task (runs while a client is subscribed)
+	SEM_ID ioSubLock;										// Protects the subscriptions and the change queues
+	int ioSubPeriod[MAX_STATE_CONNECTIONS];					// Sampling period (ms) of each client (0 = not monitoring)
+	int ioSubNum[MAX_STATE_CONNECTIONS];					// Number of addresses monitored
+	MP_IO_INFO ioSubAddr[MAX_STATE_CONNECTIONS][ROS_MAX_IO_SUBSCRIBE];
+	USHORT ioSubValue[MAX_STATE_CONNECTIONS][ROS_MAX_IO_SUBSCRIBE];	// Values of the last sample
+	BOOL bIoSubSampled[MAX_STATE_CONNECTIONS];				// ioSubValue is valid (the first sample reports every address)
+	ULONG ioSubLastTick[MAX_STATE_CONNECTIONS];				// Time the last sample was due (samples are every ioSubPeriod from it)
+	UINT32 ioChangeCnt[MAX_STATE_CONNECTIONS];				// Number of change messages posted (next entry: ioChangeCnt % IO_CHANGE_QUEUE_SIZE)
+	UINT32 ioChangeSent[MAX_STATE_CONNECTIONS];				// Number of change messages processed by the state server
+	SmBodyMotoIOChange ioChange[MAX_STATE_CONNECTIONS][IO_CHANGE_QUEUE_SIZE];
+
 	// Connection Server
 	int tidConnectionSrv;
 
 	// State Server Connection
 	int tidStateSendState;  								// ThreadId of thread sending the controller state
 	int	sdStateConnections[MAX_STATE_CONNECTIONS];			// Socket Descriptor array for State Server
+	ULONG stateClientAddr[MAX_STATE_CONNECTIONS];			// IP address of each client (network byte order)
+	int stateDecimation[MAX_STATE_CONNECTIONS];				// Publish every N feedback snapshots (0 = every STATE_UPDATE_MIN_PERIOD)
+	int stateFormat[MAX_STATE_CONNECTIONS];					// Messages used to publish the state to each client (SmStateFormat)
+	int stateGroupMask[MAX_STATE_CONNECTIONS];				// Groups published to each client (bit N = group N)
+	int stateFieldMask[MAX_STATE_CONNECTIONS];				// Fields published to each client (SmStateField bits)
+	StateSendQueue* stateSendQ[MAX_STATE_CONNECTIONS];		// Outgoing buffer of each client (allocated while connected)
+	UINT32 stateLastCycle[MAX_STATE_CONNECTIONS];			// Snapshot cycle last published to each client
+
+	// State Server UDP clients
+	int sdStateUdp;											// Socket Descriptor of UDP_PORT_STATE
+	BOOL bUdpStateClient[MAX_UDP_STATE_CLIENTS];			// Endpoint registered
+	struct sockaddr_in udpStateAddr[MAX_UDP_STATE_CLIENTS];	// Endpoint the feedback datagrams are sent to
+	int udpStateDecimation[MAX_UDP_STATE_CLIENTS];			// Publish every N feedback snapshots (0 = every STATE_UPDATE_MIN_PERIOD)
+	UINT32 udpStateLastCycle[MAX_UDP_STATE_CLIENTS];		// Snapshot cycle last published to each client
+	UINT32 udpStateSequence[MAX_UDP_STATE_CLIENTS];			// Sequence number of the last datagram sent to each client
+	ULONG udpStateRegTick[MAX_UDP_STATE_CLIENTS];			// Last time the client registered (expires after UDP_STATE_CLIENT_TIMEOUT)
+
+	// Feedback snapshot sampled by the IP task
+	volatile UINT32 fbSnapshotSeq;							// Incremented before and after each update (odd while being updated)
+	UINT32 fbSnapshotCycle;									// Number of snapshots taken
+	ULONG fbSnapshotTick;									// Time of the last snapshot
+	SEM_ID semFbSnapshot;									// Given by the IP task after each snapshot
 
 	// Motion Server Connection
 	int	sdMotionConnections[MAX_MOTION_CONNECTIONS];		// Socket Descriptor array for Motion Server
+	ULONG motionClientAddr[MAX_MOTION_CONNECTIONS];			// IP address of each client (network byte order)
 	int	tidMotionConnections[MAX_MOTION_CONNECTIONS];  		// ThreadId array for Motion Server
 	int tidIncMoveThread;  									// ThreadId for sending the incremental move to the controller
 
@@ -135,11 +282,18 @@ typedef struct
 
 extern BOOL Ros_Controller_Init(Controller* controller);
 extern BOOL Ros_Controller_IsValidGroupNo(Controller* controller, int groupNo);
+extern BOOL Ros_Controller_IsConnectedAddr(Controller* controller, struct sockaddr_in* addr);
 extern void Ros_Controller_ConnectionServer_Start(Controller* controller);
 
 extern void Ros_Controller_StatusInit(Controller* controller);
 extern BOOL Ros_Controller_StatusRead(Controller* controller, USHORT ioStatus[IO_ROBOTSTATUS_MAX]);
 extern BOOL Ros_Controller_StatusUpdate(Controller* controller);
+extern void Ros_Controller_StatusWordUpdate(Controller* controller);
+extern BOOL Ros_Controller_GetStatusEvent(Controller* controller, SmBodyMotoStatusEvent* event);
+extern void Ros_Controller_SampleFeedback(Controller* controller);
+extern void Ros_Controller_ReadFeedback(Controller* controller, FeedbackSample* samples[MP_GRP_NUM]);
+extern UINT32 Ros_Controller_GetFeedbackSnapshot(Controller* controller, FeedbackSample samples[MP_GRP_NUM]);
+extern BOOL Ros_Controller_GetFeedbackSample(Controller* controller, int groupNo, FeedbackSample* sample);
 extern BOOL Ros_Controller_IsAlarm(Controller* controller);
 extern BOOL Ros_Controller_IsError(Controller* controller);
 extern BOOL Ros_Controller_IsPlay(Controller* controller);
@@ -157,6 +311,8 @@ extern int Ros_Controller_StatusToMsg(Controller* controller, SimpleMsg* sendMsg
 
 extern BOOL Ros_Controller_GetIOState(ULONG signal);
 extern void Ros_Controller_SetIOState(ULONG signal, BOOL status);
+extern BOOL Ros_Controller_ReadIOCached(Controller* controller, ULONG address, USHORT* value, int maxAge_ms);
+extern void Ros_Controller_RefreshIOCache(Controller* controller);
 extern void Ros_Controller_ErrNo_ToString(int errNo, char errMsg[ERROR_MSG_MAX_SIZE], int errMsgSize);
 
 #ifdef DX100
@@ -170,6 +326,9 @@ typedef enum
 extern void motoRosAssert(BOOL mustBeTrue, ROS_ASSERTION_CODE subCodeIfFalse, char* msgFmtIfFalse, ...);
 
 extern void Ros_Sleep(float milliseconds);
+extern void Ros_Controller_GetTime(RosTime* time);
+extern int Ros_Controller_TimeDiff(RosTime* startTime, RosTime* endTime);
+extern int Ros_Controller_ClockSyncReply(SimpleMsg* receiveMsg, RosTime* receiveTime, SimpleMsg* replyMsg);
 
 //#define DUMMY_SERVO_MODE 1	// Dummy servo mode is used for testing with Yaskawa debug controllers
 #ifdef DUMMY_SERVO_MODE
@@ -42,11 +42,18 @@ MP_GRP_ID_TYPE Ros_CtrlGroup_FindGrpId(int groupNo);
 CtrlGroup* Ros_CtrlGroup_Create(int groupNo, float interpolPeriod);
 BOOL Ros_CtrlGroup_GetPulsePosCmd(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES]);
 BOOL Ros_CtrlGroup_GetFBPulsePos(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES]);
+BOOL Ros_CtrlGroup_ReadFeedback(CtrlGroup* ctrlGroup, FeedbackSample* sample);
+BOOL Ros_CtrlGroup_GetTorque(CtrlGroup* ctrlGroup, double torqueValues[MAX_PULSE_AXES]);
+BOOL Ros_CtrlGroup_GetFBServoSpeedTorque(CtrlGroup* ctrlGroup, long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES]);
+void Ros_CtrlGroup_ExtractServoSpeedTorque(CtrlGroup* ctrlGroup, MP_GRP_AXES_T dst_vel, MP_TRQ_CTL_VAL* dst_trq, 
+									long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES]);
+BOOL Ros_CtrlGroup_ReadFeedbackPos(CtrlGroup* ctrlGroup, FeedbackSample* sample);
 void Ros_CtrlGroup_ConvertToRosPos(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES], 
 									float rosPos[MAX_PULSE_AXES]);
 void Ros_CtrlGroup_ConvertToMotoPos(CtrlGroup* ctrlGroup, float rosPos[MAX_PULSE_AXES],
 									long pulsePos[MAX_PULSE_AXES]);
 UCHAR Ros_CtrlGroup_GetAxisConfig(CtrlGroup* ctrlGroup);
+UCHAR Ros_CtrlGroup_GetRosJointConfig(CtrlGroup* ctrlGroup);
 BOOL Ros_CtrlGroup_IsRobot(CtrlGroup* ctrlGroup);
 
 //-----------------------
@@ -329,17 +336,57 @@ BOOL Ros_CtrlGroup_GetFBPulsePos(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_A
 	return TRUE;
 }
 
+//-------------------------------------------------------------------
+// Read the feedback position, command position, servo speed and torque
+// of the group
+// return: TRUE if the feedback position was read
+//-------------------------------------------------------------------
+BOOL Ros_CtrlGroup_ReadFeedback(CtrlGroup* ctrlGroup, FeedbackSample* sample)
+{
+	Ros_CtrlGroup_ReadFeedbackPos(ctrlGroup, sample);
+	sample->bTorqueValid = Ros_CtrlGroup_GetFBServoSpeedTorque(ctrlGroup, sample->pulseSpeed, sample->torque);
+	sample->bSpeedValid = sample->bTorqueValid;
+
+	return sample->bPosValid;
+}
+
+//-------------------------------------------------------------------
+// Read the feedback position and command position of the group
+// (servo speed and torque are read for all groups by the caller)
+// return: TRUE if the feedback position was read
+//-------------------------------------------------------------------
+BOOL Ros_CtrlGroup_ReadFeedbackPos(CtrlGroup* ctrlGroup, FeedbackSample* sample)
+{
+	Ros_Controller_GetTime(&sample->time);
+	sample->bPosValid = Ros_CtrlGroup_GetFBPulsePos(ctrlGroup, sample->pulsePos);
+	sample->bCmdPosValid = Ros_CtrlGroup_GetPulsePosCmd(ctrlGroup, sample->cmdPulsePos);
+
+	return sample->bPosValid;
+}
+
 //-------------------------------------------------------------------
 // Retrieves the absolute value (Nm) of the maximum current servo torque.
 //-------------------------------------------------------------------
 BOOL Ros_CtrlGroup_GetTorque(CtrlGroup* ctrlGroup, double torqueValues[MAX_PULSE_AXES])
+{
+	long pulseSpeed[MAX_PULSE_AXES];
+
+	return Ros_CtrlGroup_GetFBServoSpeedTorque(ctrlGroup, pulseSpeed, torqueValues);
+}
+
+//-------------------------------------------------------------------
+// Retrieves the servo speed feedback (pulse/s) and torque (Nm) of the
+// group with a single mpSvsGetVelTrqFb call.
+//-------------------------------------------------------------------
+BOOL Ros_CtrlGroup_GetFBServoSpeedTorque(CtrlGroup* ctrlGroup, long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES])
 {
     MP_GRP_AXES_T dst_vel;
     MP_TRQ_CTL_VAL dst_trq;
   	LONG status = 0;
-  	int i;
 
-	memset(torqueValues, 0, sizeof(torqueValues)); // clear result, in case of error
+	// clear result, in case of error
+	memset(pulseSpeed, 0, sizeof(long) * MAX_PULSE_AXES);
+	memset(torqueValues, 0, sizeof(double) * MAX_PULSE_AXES);
 	memset(dst_trq.data, 0, sizeof(MP_TRQCTL_DATA));
 	dst_trq.unit = TRQ_NEWTON_METER; //request data in Nm
 
@@ -347,13 +394,28 @@ BOOL Ros_CtrlGroup_GetTorque(CtrlGroup* ctrlGroup, double torqueValues[MAX_PULSE
 	if (status != OK)
 		return FALSE;
 
+	Ros_CtrlGroup_ExtractServoSpeedTorque(ctrlGroup, dst_vel, &dst_trq, pulseSpeed, torqueValues);
+    
+    return TRUE;
+}
+
+//-------------------------------------------------------------------
+// Extract the servo speed (pulse/s) and torque (Nm) of the group from
+// the data of all groups returned by mpSvsGetVelTrqFb (torque in 
+// TRQ_NEWTON_METER unit).
+//-------------------------------------------------------------------
+void Ros_CtrlGroup_ExtractServoSpeedTorque(CtrlGroup* ctrlGroup, MP_GRP_AXES_T dst_vel, MP_TRQ_CTL_VAL* dst_trq, 
+									long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES])
+{
+  	int i;
+
 	for (i = 0; i < MAX_PULSE_AXES; i += 1) 
 	{
-	    torqueValues[i] = (double)dst_trq.data[ctrlGroup->groupId][i] * 0.000001; //Use double.  Float only good for 6 sig digits.
+	    pulseSpeed[i] = dst_vel[ctrlGroup->groupId][i];
+	    torqueValues[i] = (double)dst_trq->data[ctrlGroup->groupId][i] * 0.000001; //Use double.  Float only good for 6 sig digits.
 	}
-    
-    return TRUE;
 }
+
 // Convert Motoman position in pulse to Ros position in radian/meters
 // In the case of a 7, 4, or 5 axis robot, adjust the order to match 
 // the physical axis sequence
@@ -511,6 +573,19 @@ UCHAR Ros_CtrlGroup_GetAxisConfig(CtrlGroup* ctrlGroup)
 	return (UCHAR)axisConfig;
 }
 
+//-------------------------------------------------------------------
+// Returns a bit mask of the joints filled by Ros_CtrlGroup_ConvertToRosPos
+// (Base to Tool joint order)
+//-------------------------------------------------------------------
+UCHAR Ros_CtrlGroup_GetRosJointConfig(CtrlGroup* ctrlGroup)
+{
+	// The valid axes are moved first for 7 axis robots and robots with less than 6 axes
+	if (Ros_CtrlGroup_IsRobot(ctrlGroup) && (ctrlGroup->numAxes == 7 || ctrlGroup->numAxes < 6))
+		return (UCHAR)((0x01 << ctrlGroup->numAxes) - 1);
+
+	return Ros_CtrlGroup_GetAxisConfig(ctrlGroup);
+}
+
 //-------------------------------------------------------------------
 // Returns TRUE is the specified group is defined as a robot
 //-------------------------------------------------------------------
@@ -29,6 +29,10 @@
 * POSSIBILITY OF SUCH DAMAGE.
 */ 
 
+// SimpleMessage.h defines RosTime before including this file (included first so
+// the message types are complete whichever of the two headers is included first)
+#include "SimpleMessage.h"
+
 #ifndef CTRLGROUP_H
 #define CTRLGROUP_H
 
@@ -40,6 +44,9 @@
 
 #define Q_LOCK_TIMEOUT 1000
 
+#define Q_IO_ACTION_SIZE 4			// IO actions attached to an entry of the incremental queue
+#define PENDING_IO_ACTION_SIZE 16	// IO actions received with the trajectory points and not attached to a queue entry yet
+
 #define	Q_OFFSET_IDX( a, b, c )	(((a)+(b)) >= (c) ) ? ((a)+(b)-(c)) \
 				: ( (((a)+(b)) < 0 ) ? ((a)+(b)+(c)) : ((a)+(b)) )
 				
@@ -50,6 +57,10 @@ typedef struct
 	UCHAR user;
 	UCHAR tool;
 	LONG inc[MP_GRP_AXES_NUM];
+	float pos[MP_GRP_AXES_NUM];		// trajectory position (radians) reached at the end of the increment
+	float vel[MP_GRP_AXES_NUM];		// trajectory velocity (radians/s) reached at the end of the increment
+	int numIoActions;
+	MP_IO_DATA ioAction[Q_IO_ACTION_SIZE];	// IO written by the IP task in the cycle the increment is sent
 } Incremental_data;
 
 typedef struct
@@ -60,6 +71,20 @@ typedef struct
 	Incremental_data data[Q_SIZE];
 } Incremental_q;
 
+// Feedback of a control group read in the same cycle (Ros_CtrlGroup_ReadFeedback)
+typedef struct
+{
+	RosTime time;						// controller time when the feedback was read
+	BOOL bPosValid;
+	long pulsePos[MAX_PULSE_AXES];		// feedback position (pulse)
+	BOOL bCmdPosValid;
+	long cmdPulsePos[MAX_PULSE_AXES];	// command position (pulse)
+	BOOL bTorqueValid;
+	double torque[MAX_PULSE_AXES];		// servo torque (Nm)
+	BOOL bSpeedValid;
+	long pulseSpeed[MAX_PULSE_AXES];	// servo speed (pulse/s)
+} FeedbackSample;
+
 
 
 // jointMotionData values are in radian and joint order in sequential order 
@@ -89,16 +114,28 @@ typedef struct
 	
 	Incremental_q inc_q;						// incremental queue
 	long q_time;								// time to which the queue has been processed
+	float q_partialTime;						// time (ms) of the entry at the head of the queue already processed (time scaled motion)
+	LONG q_partialInc[MP_GRP_AXES_NUM];			// increments of the entry at the head of the queue already sent (time scaled motion)
 	
 	JointMotionData jointMotionData;			// joint motion command data in radian
 	JointMotionData jointMotionDataToProcess;	// joint motion command data in radian to process
 	BOOL hasDataToProcess;						// indicates that there is data to process
+	BOOL bSpliceTraj;							// requests the interpolation of the point being processed to be aborted (trajectory splice)
+	int trajStartTime_ms;						// time of the first point of the trajectory (origin of the interpolation periods)
+	BOOL bPrefillHold;							// trajectory start is held until enough motion is buffered
+	BOOL bTrajEndReceived;						// last point of the trajectory was received (validFields & 32)
+	int numPendingIo;							// IO actions of the received points waiting for the increment reaching their time
+	long pendingIoTime[PENDING_IO_ACTION_SIZE];	// trajectory time (ms) of each pending IO action
+	MP_IO_DATA pendingIo[PENDING_IO_ACTION_SIZE];
+	int lowQueueCycles;							// consecutive IP cycles with a pending point and less than lagQueueThreshold_ms buffered
 	int tidAddToIncQueue;						// ThreadId to add incremental values to the queue
 	int timeLeftover_ms;						// Time left over after reaching the end of a trajectory to complete the interpolation period
 	long prevPulsePos[MAX_PULSE_AXES];			// The commanded pulse position that the trajectory starts at (Ros_MotionServer_StartTrajMode)
 	AXIS_MOTION_TYPE axisType;					// Indicates whether axis is rotary or linear
 
 	BOOL bIsBaxisSlave;							// Indicates the B axis will automatically move to maintain orientation as other axes are moved
+
+	FeedbackSample fbSnapshot;					// Feedback of the last snapshot (Ros_Controller_SampleFeedback)
 } CtrlGroup;
 
 
@@ -113,11 +150,21 @@ extern BOOL Ros_CtrlGroup_GetPulsePosCmd(CtrlGroup* ctrlGroup, long pulsePos[MAX
 extern BOOL Ros_CtrlGroup_GetFBPulsePos(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES]);
 
 extern BOOL Ros_CtrlGroup_GetTorque(CtrlGroup* ctrlGroup, double torqueValues[MAX_PULSE_AXES]);
+
+extern BOOL Ros_CtrlGroup_GetFBServoSpeedTorque(CtrlGroup* ctrlGroup, long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES]);
+
+extern void Ros_CtrlGroup_ExtractServoSpeedTorque(CtrlGroup* ctrlGroup, MP_GRP_AXES_T dst_vel, MP_TRQ_CTL_VAL* dst_trq, 
+									long pulseSpeed[MAX_PULSE_AXES], double torqueValues[MAX_PULSE_AXES]);
+
+extern BOOL Ros_CtrlGroup_ReadFeedbackPos(CtrlGroup* ctrlGroup, FeedbackSample* sample);
+
+extern BOOL Ros_CtrlGroup_ReadFeedback(CtrlGroup* ctrlGroup, FeedbackSample* sample);
 extern void Ros_CtrlGroup_ConvertToRosPos(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES], float rosPos[MAX_PULSE_AXES]);
 
 extern void Ros_CtrlGroup_ConvertToMotoPos(CtrlGroup* ctrlGroup, float radPos[MAX_PULSE_AXES], long pulsePos[MAX_PULSE_AXES]);
 
 extern UCHAR Ros_CtrlGroup_GetAxisConfig(CtrlGroup* ctrlGroup);
+extern UCHAR Ros_CtrlGroup_GetRosJointConfig(CtrlGroup* ctrlGroup);
 
 extern BOOL Ros_CtrlGroup_IsRobot(CtrlGroup* ctrlGroup);
 
@@ -48,13 +48,18 @@
 // Function Declarations
 //-----------------------
 // Main Task: 
-void Ros_MotionServer_StartNewConnection(Controller* controller, int sd);
+void Ros_MotionServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr);
+BOOL Ros_MotionServer_StartIncMoveTask(Controller* controller);
 void Ros_MotionServer_StopConnection(Controller* controller, int connectionIndex);
 // WaitForSimpleMsg Task:
 void Ros_MotionServer_WaitForSimpleMsg(Controller* controller, int connectionIndex);
 BOOL Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receiveMsg, int byteSize, SimpleMsg* replyMsg);
 int Ros_MotionServer_MotionCtrlProcess(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 BOOL Ros_MotionServer_StopMotion(Controller* controller);
+int Ros_MotionServer_PauseMotion(Controller* controller, float rampTime);
+int Ros_MotionServer_ResumeMotion(Controller* controller, float rampTime);
+BOOL Ros_MotionServer_IsPaused(Controller* controller);
+int Ros_MotionServer_SpliceTraj(Controller* controller, int groupNo, int spliceTime_ms, JointMotionData* spliceData);
 BOOL Ros_MotionServer_ServoPower(Controller* controller, int servoOnOff);
 BOOL Ros_MotionServer_ResetAlarm(Controller* controller);
 
@@ -73,8 +78,31 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 BOOL Ros_MotionServer_AddPulseIncPointToQ(Controller* controller, int groupNo, Incremental_data* dataToEnQ);
 BOOL Ros_MotionServer_ClearQ_All(Controller* controller);
 BOOL Ros_MotionServer_HasDataInQueue(Controller* controller);
+BOOL Ros_MotionServer_IsPrefillHold(Controller* controller);
 int Ros_MotionServer_GetQueueCnt(Controller* controller, int groupNo);
+void Ros_MotionServer_QueueStatusToReply(Controller* controller, SimpleMsg* replyMsg);
+int Ros_MotionServer_ReadQueueTime(Controller* controller, int groupNo, int lockTimeout, int* queueFree, int* pendingTime);
 void Ros_MotionServer_IncMoveLoopStart(Controller* controller);
+void Ros_MotionServer_SetSpeedScale(Controller* controller, float speedScale, int rampTime_ms);
+void Ros_MotionServer_UpdateSpeedScale(Controller* controller);
+int Ros_MotionServer_GetSpeedRampTime(Controller* controller);
+void Ros_MotionServer_RideThrough(Controller* controller);
+void Ros_MotionServer_GetScaledIncFromQ(Controller* controller, int groupNo, LONG inc[MP_GRP_AXES_NUM], MP_IO_DATA ioWrite[], int* numIoWrite);
+int Ros_MotionServer_AddTrajIoActions(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFull* jointTrajData);
+void Ros_MotionServer_AttachIoActions(CtrlGroup* ctrlGroup, Incremental_data* incData, BOOL bTrajEnd);
+void Ros_MotionServer_PendIoActions(CtrlGroup* ctrlGroup, Incremental_data* entry);
+void Ros_MotionServer_CollectIoActions(Incremental_data* entry, MP_IO_DATA ioWrite[], int* numIoWrite);
+void Ros_MotionServer_WriteIoActions(MP_IO_DATA ioWrite[], int* numIoWrite);
+void Ros_MotionServer_LagMonitor(Controller* controller, RosTime* cycleStartTime, RosTime* prevCycleStartTime);
+void Ros_MotionServer_ResetLagStats(Controller* controller);
+void Ros_MotionServer_TraceInit(Controller* controller);
+void Ros_MotionServer_TraceStart(Controller* controller);
+int Ros_MotionServer_TraceTrigger(Controller* controller, int postTrigger_ms);
+#if DX100
+void Ros_MotionServer_TraceRecord(Controller* controller, MP_POS_DATA* moveData, BOOL bMoved, ULONG cycleStartTick);
+#else
+void Ros_MotionServer_TraceRecord(Controller* controller, MP_EXPOS_DATA* moveData, BOOL bMoved, ULONG cycleStartTick);
+#endif
 // Utility functions:
 void Ros_MotionServer_ConvertToJointMotionData(SmBodyJointTrajPtFull* jointTrajData, JointMotionData* jointMotionData);
 STATUS Ros_MotionServer_DisableEcoMode(Controller* controller);
@@ -82,11 +110,17 @@ void Ros_MotionServer_PrintError(USHORT err_no, char* msgPrefix);
 
 // IO functions:
 int Ros_MotionServer_GetVersion( SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_GetDiagnostics(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_TraceRead(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 
-int Ros_MotionServer_ReadIOBit(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_ReadIOBit(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 int Ros_MotionServer_WriteIOBit(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 int Ros_MotionServer_ReadIOGroup(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 int Ros_MotionServer_WriteIOGroup(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_ReadIOGroups(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_WriteIOGroups(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_ReadIOList(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
+int Ros_MotionServer_WriteIOList(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 
 //-----------------------
 // Function implementation
@@ -97,7 +131,7 @@ int Ros_MotionServer_WriteIOGroup(SimpleMsg* receiveMsg, SimpleMsg* replyMsg);
 // - WaitForSimpleMsg: Task that waits to receive new SimpleMessage
 // - AddToIncQueueProcess: Task that take data from a message and generate Incmove  
 //-----------------------------------------------------------------------
-void Ros_MotionServer_StartNewConnection(Controller* controller, int sd)
+void Ros_MotionServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr)
 {
 	int groupNo;
 	int connectionIndex;
@@ -107,6 +141,7 @@ void Ros_MotionServer_StartNewConnection(Controller* controller, int sd)
 	{
 		if (controller->sdMotionConnections[connectionIndex] == INVALID_SOCKET)
 		{
+			controller->motionClientAddr[connectionIndex] = clientAddr;
 			controller->sdMotionConnections[connectionIndex] = sd;
 			break;
 		}
@@ -119,23 +154,17 @@ void Ros_MotionServer_StartNewConnection(Controller* controller, int sd)
 		return;
 	}
 	
+	// Trajectories of a new connection start without buffering or ride-through until requested
+	controller->startThreshold_ms = MOTION_START_THRESHOLD;
+	controller->bRideThrough = FALSE;
+	controller->rideThroughMargin_ms = RIDE_THROUGH_MARGIN;
+	controller->bMotionReplyEx = FALSE;
+
 	// If not started, start the IncMoveTask (there should be only one instance of this thread)
-	if(controller->tidIncMoveThread == INVALID_TASK)
+	if(!Ros_MotionServer_StartIncMoveTask(controller))
 	{
-#ifdef DEBUG
-		puts("Creating new task: IncMoveTask");
-#endif
-		controller->tidIncMoveThread = mpCreateTask(MP_PRI_IP_CLK_TAKE, MP_STACK_SIZE, 
-													(FUNCPTR)Ros_MotionServer_IncMoveLoopStart,
-													(int)controller, 0, 0, 0, 0, 0, 0, 0, 0, 0);
-		if (controller->tidIncMoveThread == ERROR)
-		{
-			puts("Failed to create task for incremental-motion.  Check robot parameters.");
-			mpClose(sd);
-			controller->tidIncMoveThread = INVALID_TASK;
-			Ros_Controller_SetIOState(IO_FEEDBACK_FAILURE, TRUE);
-			return;
-		}
+		mpClose(sd);
+		return;
 	}
 	
 	// If not started, start the AddToIncQueueProcess for each control group
@@ -189,6 +218,34 @@ void Ros_MotionServer_StartNewConnection(Controller* controller, int sd)
 }
 
 
+//-----------------------------------------------------------------------
+// Start the IncMoveTask if it isn't running.  Once started, it runs for
+// the life of the application since it also samples the feedback for
+// the state server.
+//-----------------------------------------------------------------------
+BOOL Ros_MotionServer_StartIncMoveTask(Controller* controller)
+{
+	if(controller->tidIncMoveThread == INVALID_TASK)
+	{
+#ifdef DEBUG
+		puts("Creating new task: IncMoveTask");
+#endif
+		controller->tidIncMoveThread = mpCreateTask(MP_PRI_IP_CLK_TAKE, MP_STACK_SIZE, 
+													(FUNCPTR)Ros_MotionServer_IncMoveLoopStart,
+													(int)controller, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		if (controller->tidIncMoveThread == ERROR)
+		{
+			puts("Failed to create task for incremental-motion.  Check robot parameters.");
+			controller->tidIncMoveThread = INVALID_TASK;
+			Ros_Controller_SetIOState(IO_FEEDBACK_FAILURE, TRUE);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+
 //-----------------------------------------------------------------------
 // Close a connection along with all its associated task
 //-----------------------------------------------------------------------
@@ -196,7 +253,7 @@ void Ros_MotionServer_StopConnection(Controller* controller, int connectionIndex
 {   
 	int i;
 	int tid;
-	BOOL bDeleteIncMovTask;
+	BOOL bStopIncMove;
 	
 	printf("Closing Motion Server Connection\r\n");
 	
@@ -206,18 +263,18 @@ void Ros_MotionServer_StopConnection(Controller* controller, int connectionIndex
 	controller->sdMotionConnections[connectionIndex] = INVALID_SOCKET;
 
 	// Check if there are still some valid connection
-	bDeleteIncMovTask = TRUE;
+	bStopIncMove = TRUE;
 	for(i=0; i<MAX_MOTION_CONNECTIONS; i++)
 	{
 		if(controller->sdMotionConnections[connectionIndex] != INVALID_SOCKET)
 		{
-			bDeleteIncMovTask = FALSE;
+			bStopIncMove = FALSE;
 			break;
 		}
 	}
 	
-	// If there is no more connection, stop the inc_move task
-	if(bDeleteIncMovTask)
+	// If there is no more connection, stop the incremental motion
+	if(bStopIncMove)
 	{
 		//set feedback signal
 		Ros_Controller_SetIOState(IO_FEEDBACK_MOTIONSERVERCONNECTED, FALSE);
@@ -231,10 +288,8 @@ void Ros_MotionServer_StopConnection(Controller* controller, int connectionIndex
 			mpDeleteTask(tid);
 		}
 		
-		// terminate the inc_move task
-		tid = controller->tidIncMoveThread;
-		controller->tidIncMoveThread = INVALID_TASK;
-		mpDeleteTask(tid);
+		// discard the remaining motion (the inc_move task keeps running to sample the feedback)
+		Ros_MotionServer_ClearQ_All(controller);
 	}
 		
 	// Stop message receiption task
@@ -286,11 +341,24 @@ void Ros_MotionServer_WaitForSimpleMsg(Controller* controller, int connectionInd
 				case ROS_MSG_GET_VERSION: 
 					expectedSize = minSize;
 					break;
+				case ROS_MSG_MOTO_GET_DIAGNOSTICS:
+					expectedSize = minSize + sizeof(SmBodyMotoGetDiagnostics);
+					break;
+				case ROS_MSG_MOTO_TRACE_READ:
+					expectedSize = minSize + sizeof(SmBodyMotoTraceRead);
+					break;
+				case ROS_MSG_MOTO_CLOCK_SYNC:
+					expectedSize = minSize + sizeof(SmBodyMotoClockSync);
+					break;
 				case ROS_MSG_ROBOT_STATUS: 
 					expectedSize = minSize + sizeof(SmBodyRobotStatus);
 					break;
 				case ROS_MSG_JOINT_TRAJ_PT_FULL: 
-					expectedSize = minSize + sizeof(SmBodyJointTrajPtFull);
+					//The IO actions are only sent if validFields&64 is set
+					expectedSize = minSize + ROS_JOINT_TRAJ_PT_FULL_SIZE;
+					if ((byteSize >= expectedSize + sizeof(UINT32)) && (receiveMsg.body.jointTrajData.validFields & 0x40)
+						&& (receiveMsg.body.jointTrajData.numIoActions <= ROS_MAX_TRAJ_IO_ACTIONS))
+						expectedSize += sizeof(UINT32) + (sizeof(SmTrajIOAction) * receiveMsg.body.jointTrajData.numIoActions);
 					break;
 				case ROS_MSG_JOINT_FEEDBACK:
 					expectedSize = minSize + sizeof(SmBodyJointFeedback);
@@ -316,7 +384,11 @@ void Ros_MotionServer_WaitForSimpleMsg(Controller* controller, int connectionInd
 					break;
 					
 				case ROS_MSG_MOTO_READ_IO_BIT:
-					expectedSize = minSize + sizeof(SmBodyMotoReadIOBit);
+					//maxAge is optional, use the length of the message to know if it was sent
+					if (receiveMsg.prefix.length == sizeof(SmHeader) + sizeof(SmBodyMotoReadIOBit))
+						expectedSize = minSize + sizeof(SmBodyMotoReadIOBit);
+					else
+						expectedSize = minSize + sizeof(UINT32);
 					break;
 				case ROS_MSG_MOTO_WRITE_IO_BIT:
 					expectedSize = minSize + sizeof(SmBodyMotoWriteIOBit);
@@ -327,6 +399,30 @@ void Ros_MotionServer_WaitForSimpleMsg(Controller* controller, int connectionInd
 				case ROS_MSG_MOTO_WRITE_IO_GROUP:
 					expectedSize = minSize + sizeof(SmBodyMotoWriteIOGroup);
 					break;
+				case ROS_MSG_MOTO_READ_IO_GROUPS:
+					expectedSize = minSize + sizeof(SmBodyMotoReadIOGroups);
+					break;
+				case ROS_MSG_MOTO_WRITE_IO_GROUPS:
+					//Only the bytes in use are sent
+					if (byteSize >= (minSize + (sizeof(UINT32) * 2)) && receiveMsg.body.writeIOGroups.numBytes <= ROS_MAX_IO_GROUP_BYTES)
+						expectedSize = minSize + (sizeof(UINT32) * 2) + receiveMsg.body.writeIOGroups.numBytes;
+					else
+						expectedSize = minSize + sizeof(SmBodyMotoWriteIOGroups);
+					break;
+				case ROS_MSG_MOTO_READ_IO_LIST:
+					//Only the addresses in use are sent
+					if (byteSize >= (minSize + sizeof(UINT32)) && receiveMsg.body.readIOList.numAddresses <= ROS_MAX_IO_LIST)
+						expectedSize = minSize + sizeof(UINT32) + (sizeof(UINT32) * receiveMsg.body.readIOList.numAddresses);
+					else
+						expectedSize = minSize + sizeof(SmBodyMotoReadIOList);
+					break;
+				case ROS_MSG_MOTO_WRITE_IO_LIST:
+					//Only the entries in use are sent
+					if (byteSize >= (minSize + sizeof(UINT32)) && receiveMsg.body.writeIOList.numEntries <= ROS_MAX_IO_WRITE_LIST)
+						expectedSize = minSize + sizeof(UINT32) + (sizeof(SmIOListEntry) * receiveMsg.body.writeIOList.numEntries);
+					else
+						expectedSize = minSize + sizeof(SmBodyMotoWriteIOList);
+					break;
 				default:
 					bInvalidMsgType = TRUE;
 					break;
@@ -364,6 +460,10 @@ void Ros_MotionServer_WaitForSimpleMsg(Controller* controller, int connectionInd
 			// we may need to add code to store unused portion of the received buff that would be part of the next message
 		}
 
+		// Report the queue state so that the client can pace the trajectory points (if requested)
+		if(controller->bMotionReplyEx && replyMsg.header.msgType == ROS_MSG_MOTO_MOTION_REPLY)
+			Ros_MotionServer_QueueStatusToReply(controller, &replyMsg);
+
 		//Send reply message
 		byteSizeResponse = mpSend(controller->sdMotionConnections[connectionIndex], (char*)(&replyMsg), replyMsg.prefix.length + sizeof(SmPrefix), 0);        
 		if (byteSizeResponse <= 0)
@@ -387,6 +487,7 @@ int Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receive
 	int ret = 0;
 	int expectedBytes = sizeof(SmPrefix) + sizeof(SmHeader);
 	int invalidSubcode = 0;
+	RosTime receiveTime;
 	
 	//printf("In SimpleMsgProcess\r\n");
 	
@@ -399,9 +500,41 @@ int Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receive
 			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
 		break;
         
+	case ROS_MSG_MOTO_GET_DIAGNOSTICS:
+		expectedBytes += sizeof(SmBodyMotoGetDiagnostics);
+		if(expectedBytes == byteSize)
+			ret = Ros_MotionServer_GetDiagnostics(controller, receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
+	case ROS_MSG_MOTO_TRACE_READ:
+		expectedBytes += sizeof(SmBodyMotoTraceRead);
+		if(expectedBytes == byteSize)
+			ret = Ros_MotionServer_TraceRead(controller, receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
+	case ROS_MSG_MOTO_CLOCK_SYNC:
+		Ros_Controller_GetTime(&receiveTime);
+		expectedBytes += sizeof(SmBodyMotoClockSync);
+		if(expectedBytes == byteSize)
+			Ros_Controller_ClockSyncReply(receiveMsg, &receiveTime, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+        
 	case ROS_MSG_JOINT_TRAJ_PT_FULL:
-		// Check that the appropriate message size was received
-		expectedBytes += sizeof(SmBodyJointTrajPtFull);
+		// Check that the appropriate message size was received (IO actions are optional)
+		expectedBytes += ROS_JOINT_TRAJ_PT_FULL_SIZE;
+		if((byteSize >= expectedBytes + sizeof(UINT32)) && (receiveMsg->body.jointTrajData.validFields & 0x40))
+		{
+			if(receiveMsg->body.jointTrajData.numIoActions <= ROS_MAX_TRAJ_IO_ACTIONS)
+				expectedBytes += sizeof(UINT32) + (sizeof(SmTrajIOAction) * receiveMsg->body.jointTrajData.numIoActions);
+			else
+				expectedBytes = -1;
+		}
 		if(expectedBytes == byteSize)
 			ret = Ros_MotionServer_JointTrajDataProcess(controller, receiveMsg, replyMsg);
 		else
@@ -436,10 +569,14 @@ int Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receive
 		break;
 
 	case ROS_MSG_MOTO_READ_IO_BIT:
-		// Check that the appropriate message size was received
-		expectedBytes += sizeof(SmBodyMotoReadIOBit);
-		if(expectedBytes == byteSize)
-			ret = Ros_MotionServer_ReadIOBit(receiveMsg, replyMsg);
+		// Check that the appropriate message size was received (maxAge is optional, the message was received cleared)
+		if((expectedBytes + sizeof(UINT32) == byteSize) || (expectedBytes + sizeof(SmBodyMotoReadIOBit) == byteSize))
+		{
+			// Without maxAge, always read the IO (the buffer may hold the start of the next message)
+			if(expectedBytes + sizeof(UINT32) == byteSize)
+				receiveMsg->body.readIOBit.maxAge = 0;
+			ret = Ros_MotionServer_ReadIOBit(controller, receiveMsg, replyMsg);
+		}
 		else
 			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
 		break;
@@ -475,6 +612,57 @@ int Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receive
 			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
 		break;
 
+	//-----------------------
+	case ROS_MSG_MOTO_READ_IO_GROUPS:
+		// Check that the appropriate message size was received
+		expectedBytes += sizeof(SmBodyMotoReadIOGroups);
+		if (expectedBytes == byteSize
+			&& receiveMsg->body.readIOGroups.numBytes > 0
+			&& receiveMsg->body.readIOGroups.numBytes <= ROS_MAX_IO_GROUP_BYTES)
+			ret = Ros_MotionServer_ReadIOGroups(receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
+	//-----------------------
+	case ROS_MSG_MOTO_WRITE_IO_GROUPS:
+		// Check that the number of bytes matches the message size
+		expectedBytes += sizeof(UINT32) * 2;
+		if (expectedBytes <= byteSize
+			&& receiveMsg->body.writeIOGroups.numBytes > 0
+			&& receiveMsg->body.writeIOGroups.numBytes <= ROS_MAX_IO_GROUP_BYTES
+			&& expectedBytes + receiveMsg->body.writeIOGroups.numBytes == byteSize)
+			ret = Ros_MotionServer_WriteIOGroups(receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
+	//-----------------------
+	case ROS_MSG_MOTO_READ_IO_LIST:
+		// Check that the number of addresses matches the message size
+		expectedBytes += sizeof(UINT32);
+		if (expectedBytes <= byteSize
+			&& receiveMsg->body.readIOList.numAddresses > 0
+			&& receiveMsg->body.readIOList.numAddresses <= ROS_MAX_IO_LIST
+			&& expectedBytes + (sizeof(UINT32) * receiveMsg->body.readIOList.numAddresses) == byteSize)
+			ret = Ros_MotionServer_ReadIOList(receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
+	//-----------------------
+	case ROS_MSG_MOTO_WRITE_IO_LIST:
+		// Check that the number of entries matches the message size
+		expectedBytes += sizeof(UINT32);
+		if (expectedBytes <= byteSize
+			&& receiveMsg->body.writeIOList.numEntries > 0
+			&& receiveMsg->body.writeIOList.numEntries <= ROS_MAX_IO_WRITE_LIST
+			&& expectedBytes + (sizeof(SmIOListEntry) * receiveMsg->body.writeIOList.numEntries) == byteSize)
+			ret = Ros_MotionServer_WriteIOList(receiveMsg, replyMsg);
+		else
+			invalidSubcode = ROS_RESULT_INVALID_MSGSIZE;
+		break;
+
 	default:
 		printf("Invalid message type: %d\n", receiveMsg->header.msgType);
 		invalidSubcode = ROS_RESULT_INVALID_MSGTYPE;
@@ -492,11 +680,9 @@ int Ros_MotionServer_SimpleMsgProcess(Controller* controller, SimpleMsg* receive
 }
 
 
-int Ros_MotionServer_ReadIOBit(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+int Ros_MotionServer_ReadIOBit(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
 {
-	int apiRet;
-	MP_IO_INFO ioReadInfo;
-	USHORT ioValue;
+	USHORT ioValue = 0;
 	int resultCode;
 
 	//initialize memory
@@ -509,10 +695,7 @@ int Ros_MotionServer_ReadIOBit(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
 	replyMsg->header.msgType = ROS_MSG_MOTO_READ_IO_BIT_REPLY;
 	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
 	
-	ioReadInfo.ulAddr = receiveMsg->body.readIOBit.ioAddress;
-	apiRet = mpReadIO(&ioReadInfo, &ioValue, 1);
-
-	if (apiRet == OK)
+	if (Ros_Controller_ReadIOCached(controller, receiveMsg->body.readIOBit.ioAddress, &ioValue, receiveMsg->body.readIOBit.maxAge))
 		resultCode = ROS_REPLY_SUCCESS;
 	else
 		resultCode = ROS_REPLY_FAILURE;
@@ -629,151 +812,487 @@ int Ros_MotionServer_WriteIOGroup(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
 	return OK;
 }
 
-int Ros_MotionServer_GetVersion(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
-{	
+//-----------------------------------------------------------------------
+// Read consecutive IO groups with a single mpReadIO call so that a value
+// spanning several bytes is coherent
+//-----------------------------------------------------------------------
+int Ros_MotionServer_ReadIOGroups(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+{
 	int apiRet;
+	MP_IO_INFO ioReadInfo[ROS_MAX_IO_GROUP_BYTES * 8];
+	USHORT ioValue[ROS_MAX_IO_GROUP_BYTES * 8];
+	int numBytes;
 	int resultCode;
+	int i, bit;
 
 	//initialize memory
 	memset(replyMsg, 0x00, sizeof(SimpleMsg));
-	
-	// set prefix: length of message excluding the prefix
-	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyGetVersionReply);
 
 	// set header information of the reply
-	replyMsg->header.msgType = ROS_MSG_GET_VERSION_REPLY;
+	replyMsg->header.msgType = ROS_MSG_MOTO_READ_IO_GROUPS_REPLY;
 	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
 
-    if( strlen(APPLICATION_VERSION) < sizeof(replyMsg->body.versionReply.version) ) {
-        strcpy(replyMsg->body.versionReply.version, APPLICATION_VERSION);
-    }
-    else {
-        strncpy(replyMsg->body.versionReply.version, APPLICATION_VERSION, sizeof(replyMsg->body.versionReply.version)-1); // have to leave one 0
-    }
-	replyMsg->header.replyType = (SmReplyType)ROS_REPLY_SUCCESS;
+	numBytes = receiveMsg->body.readIOGroups.numBytes;
+	for (i = 0; i < numBytes; i++)
+	{
+		for (bit = 0; bit < 8; bit++)
+			ioReadInfo[(i * 8) + bit].ulAddr = ((receiveMsg->body.readIOGroups.ioAddress + i) * 10) + bit;
+	}
+	apiRet = mpReadIO(ioReadInfo, ioValue, numBytes * 8);
+
+	if (apiRet == OK)
+	{
+		resultCode = ROS_REPLY_SUCCESS;
+		for (i = 0; i < numBytes; i++)
+		{
+			for (bit = 0; bit < 8; bit++)
+				replyMsg->body.readIOGroupsReply.value[i] |= (ioValue[(i * 8) + bit] != 0) << bit;
+		}
+		replyMsg->body.readIOGroupsReply.numBytes = numBytes;
+	}
+	else
+	{
+		printf("mpReadIO failure (%d) reading %d groups\r\n", apiRet, numBytes);
+		resultCode = ROS_REPLY_FAILURE;
+	}
+
+	// set prefix: length of message excluding the prefix (only the bytes read are sent)
+	replyMsg->prefix.length = sizeof(SmHeader) + (sizeof(UINT32) * 2) + replyMsg->body.readIOGroupsReply.numBytes;
+
+	replyMsg->body.readIOGroupsReply.resultCode = resultCode;
+	replyMsg->header.replyType = (SmReplyType)resultCode;
 	return OK;
 }
 
-
 //-----------------------------------------------------------------------
-// Processes message of type: ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX
-// Return -1=Failure; 0=Success; 1=CloseConnection; 
+// Write consecutive IO groups with a single mpWriteIO call so that all
+// the bits of a multi-byte value change together
 //-----------------------------------------------------------------------
-int Ros_MotionServer_JointTrajPtFullExProcess(Controller* controller, SimpleMsg* receiveMsg, 
-											  SimpleMsg* replyMsg)
+int Ros_MotionServer_WriteIOGroups(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
 {
-	SmBodyJointTrajPtFullEx* msgBody;	
-	CtrlGroup* ctrlGroup;
-	int ret, i;
+	int apiRet;
+	MP_IO_DATA ioWriteData[ROS_MAX_IO_GROUP_BYTES * 8];
+	int numBytes;
+	int resultCode;
+	int i, bit;
 
-	msgBody = &receiveMsg->body.jointTrajDataEx;
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
 
-	// Check if controller is able to receive incremental move and if the incremental move thread is running
-	if(!Ros_Controller_IsMotionReady(controller))
-	{
-		int subcode = Ros_Controller_GetNotReadySubcode(controller);
-		printf("ERROR: Controller is not ready (code: %d).  Can't process ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX.\r\n", subcode);
-		for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
-		{
-			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_NOT_READY, subcode, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-		}
-		return 0;
-	}
+	// set prefix: length of message excluding the prefix
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoWriteIOGroupReply);
 
-	// Pre-check to ensure no groups are busy
-	for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_WRITE_IO_GROUPS_REPLY;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+
+	numBytes = receiveMsg->body.writeIOGroups.numBytes;
+	for (i = 0; i < numBytes; i++)
 	{
-		if (Ros_Controller_IsValidGroupNo(controller, msgBody->jointTrajPtData[i].groupNo))
-		{
-			ctrlGroup = controller->ctrlGroups[msgBody->jointTrajPtData[i].groupNo];
-			if (ctrlGroup->hasDataToProcess)
-			{
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-				return 0;
-			}
-		}
-		else
-		{
-			printf("ERROR: GroupNo %d is not valid\n", msgBody->jointTrajPtData[i].groupNo);
-			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_GROUPNO, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-			return 0;
-		}
-			
-		// Check that minimum information (time, position, velocity) is valid
-		if( (msgBody->jointTrajPtData[i].validFields & 0x07) != 0x07 )
+		for (bit = 0; bit < 8; bit++)
 		{
-			printf("ERROR: Validfields = %d\r\n", msgBody->jointTrajPtData[i].validFields);
-			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA_INSUFFICIENT, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-			return 0;
+			ioWriteData[(i * 8) + bit].ulAddr = ((receiveMsg->body.writeIOGroups.ioAddress + i) * 10) + bit;
+			ioWriteData[(i * 8) + bit].ulValue = (receiveMsg->body.writeIOGroups.value[i] >> bit) & 0x01;
 		}
 	}
+	apiRet = mpWriteIO(ioWriteData, numBytes * 8);
 
-	for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+	if (apiRet == OK)
+		resultCode = ROS_REPLY_SUCCESS;
+	else
 	{
-		ctrlGroup = controller->ctrlGroups[msgBody->jointTrajPtData[i].groupNo];
-		
-		// Check the trajectory sequence code
-		if(msgBody->sequence == 0) // First trajectory point
-		{
-			// Initialize first point variables
-			ret = Ros_MotionServer_InitTrajPointFullEx(ctrlGroup, &msgBody->jointTrajPtData[i], msgBody->sequence);
-		
-			// set reply
-			if(ret == 0)
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-			else
-			{
-				printf("ERROR: Ros_MotionServer_InitTrajPointFullEx returned %d\n", ret);
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ret, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-				return 0; //stop processing other groups in this loop
-			}
-		}
-		else if(msgBody->sequence > 0)// Subsequent trajectory points
-		{
-			// Add the point to the trajectory
-			ret = Ros_MotionServer_AddTrajPointFullEx(ctrlGroup, &msgBody->jointTrajPtData[i], msgBody->sequence);
-		
-			// ser reply
-			if(ret == 0)
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-			else if(ret == 1)
-			{
-				printf("ERROR: Ros_MotionServer_AddTrajPointFullEx returned %d\n", ret);
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-				return 0; //stop processing other groups in this loop
-			}
-			else
-			{
-				printf("ERROR: Ros_MotionServer_AddTrajPointFullEx returned %d\n", ret);
-				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ret, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-				return 0; //stop processing other groups in this loop
-			}
-		}
-		else
-		{
-			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_SEQUENCE, replyMsg, msgBody->jointTrajPtData[i].groupNo);
-			return 0; //stop processing other groups in this loop
-		}
+		printf("mpWriteIO failure (%d) writing %d groups\r\n", apiRet, numBytes);
+		resultCode = ROS_REPLY_FAILURE;
 	}
 
-	return 0;
+	replyMsg->body.writeIOGroupReply.resultCode = resultCode;
+	replyMsg->header.replyType = (SmReplyType)resultCode;
+	return OK;
 }
 
-
 //-----------------------------------------------------------------------
-// Processes message of type: ROS_MSG_MOTO_MOTION_CTRL
-// Return -1=Failure; 0=Success; 1=CloseConnection; 
+// Read a list of addresses with a single mpReadIO call
 //-----------------------------------------------------------------------
-int Ros_MotionServer_MotionCtrlProcess(Controller* controller, SimpleMsg* receiveMsg, 
-										SimpleMsg* replyMsg)
+int Ros_MotionServer_ReadIOList(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
 {
-	SmBodyMotoMotionCtrl* motionCtrl;
+	int apiRet;
+	MP_IO_INFO ioReadInfo[ROS_MAX_IO_LIST];
+	USHORT ioValue[ROS_MAX_IO_LIST];
+	int numAddresses;
+	int resultCode;
+	int i;
 
-	//printf("In MotionCtrlProcess\r\n");
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
 
-	// Check the command code
-	motionCtrl = &receiveMsg->body.motionCtrl;
-	switch(motionCtrl->command)
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_READ_IO_LIST_REPLY;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+
+	numAddresses = receiveMsg->body.readIOList.numAddresses;
+	for (i = 0; i < numAddresses; i++)
+		ioReadInfo[i].ulAddr = receiveMsg->body.readIOList.ioAddress[i];
+	apiRet = mpReadIO(ioReadInfo, ioValue, numAddresses);
+
+	if (apiRet == OK)
+	{
+		resultCode = ROS_REPLY_SUCCESS;
+		for (i = 0; i < numAddresses; i++)
+			replyMsg->body.readIOListReply.value[i] = ioValue[i];
+		replyMsg->body.readIOListReply.numValues = numAddresses;
+	}
+	else
+	{
+		printf("mpReadIO failure (%d) reading %d addresses\r\n", apiRet, numAddresses);
+		resultCode = ROS_REPLY_FAILURE;
+	}
+
+	// set prefix: length of message excluding the prefix (only the values read are sent)
+	replyMsg->prefix.length = sizeof(SmHeader) + (sizeof(UINT32) * 2)
+		+ (sizeof(UINT32) * replyMsg->body.readIOListReply.numValues);
+
+	replyMsg->body.readIOListReply.resultCode = resultCode;
+	replyMsg->header.replyType = (SmReplyType)resultCode;
+	return OK;
+}
+
+//-----------------------------------------------------------------------
+// Write a list of addresses with a single mpWriteIO call so that all the
+// outputs change together.  Entries are checked first and nothing is
+// written if any of them is rejected.
+//-----------------------------------------------------------------------
+int Ros_MotionServer_WriteIOList(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+{
+	int apiRet;
+	MP_IO_DATA ioWriteData[ROS_MAX_IO_WRITE_LIST];
+	SmIOListEntry* entry;
+	int numEntries;
+	int resultCode;
+	BOOL bRejected = FALSE;
+	int i, j;
+
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
+
+	// set prefix: length of message excluding the prefix (one result per entry)
+	numEntries = receiveMsg->body.writeIOList.numEntries;
+	replyMsg->prefix.length = sizeof(SmHeader) + (sizeof(UINT32) * 2) + (sizeof(UINT32) * numEntries);
+
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_WRITE_IO_LIST_REPLY;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+	replyMsg->body.writeIOListReply.numResults = numEntries;
+
+	// Check the entries: bits only take 0 or 1, registers are 16 bit and an
+	// address can only appear once (the final value would be ambiguous)
+	for (i = 0; i < numEntries; i++)
+	{
+		entry = &receiveMsg->body.writeIOList.entry[i];
+		replyMsg->body.writeIOListReply.entryResult[i] = ROS_REPLY_INVALID;
+
+		if ((entry->ioAddress < ROS_IO_REGISTER_ADDRESS_MIN && entry->ioValue > 1)
+			|| (entry->ioValue > 0xFFFF))
+		{
+			replyMsg->body.writeIOListReply.entryResult[i] = ROS_REPLY_FAILURE;
+			bRejected = TRUE;
+		}
+		for (j = 0; j < i; j++)
+		{
+			if (receiveMsg->body.writeIOList.entry[j].ioAddress == entry->ioAddress)
+			{
+				replyMsg->body.writeIOListReply.entryResult[i] = ROS_REPLY_FAILURE;
+				bRejected = TRUE;
+				break;
+			}
+		}
+
+		ioWriteData[i].ulAddr = entry->ioAddress;
+		ioWriteData[i].ulValue = entry->ioValue;
+	}
+
+	if (bRejected)
+	{
+		printf("WriteIOList: invalid entries, nothing written\r\n");
+		resultCode = ROS_REPLY_FAILURE;
+	}
+	else
+	{
+		apiRet = mpWriteIO(ioWriteData, numEntries);
+		if (apiRet == OK)
+			resultCode = ROS_REPLY_SUCCESS;
+		else
+		{
+			// The controller reports a single status for the whole call
+			printf("mpWriteIO failure (%d) writing %d addresses\r\n", apiRet, numEntries);
+			resultCode = ROS_REPLY_FAILURE;
+		}
+
+		for (i = 0; i < numEntries; i++)
+			replyMsg->body.writeIOListReply.entryResult[i] = resultCode;
+	}
+
+	replyMsg->body.writeIOListReply.resultCode = resultCode;
+	replyMsg->header.replyType = (SmReplyType)resultCode;
+	return OK;
+}
+
+int Ros_MotionServer_GetVersion(SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+{	
+	int apiRet;
+	int resultCode;
+
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
+	
+	// set prefix: length of message excluding the prefix
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyGetVersionReply);
+
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_GET_VERSION_REPLY;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+
+    if( strlen(APPLICATION_VERSION) < sizeof(replyMsg->body.versionReply.version) ) {
+        strcpy(replyMsg->body.versionReply.version, APPLICATION_VERSION);
+    }
+    else {
+        strncpy(replyMsg->body.versionReply.version, APPLICATION_VERSION, sizeof(replyMsg->body.versionReply.version)-1); // have to leave one 0
+    }
+	replyMsg->header.replyType = (SmReplyType)ROS_REPLY_SUCCESS;
+	return OK;
+}
+
+//-----------------------------------------------------------------------
+// Processes message of type: ROS_MSG_MOTO_GET_DIAGNOSTICS
+// Reports the statistics of the real-time lag monitor
+//-----------------------------------------------------------------------
+int Ros_MotionServer_GetDiagnostics(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+{
+	SmBodyMotoDiagnosticsReply* diag;
+	BOOL bReset = (receiveMsg->body.getDiagnostics.resetStats == 1);
+
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
+	
+	// set prefix: length of message excluding the prefix
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoDiagnosticsReply);
+
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_GET_DIAGNOSTICS_REPLY;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+	replyMsg->header.replyType = ROS_REPLY_SUCCESS;
+
+	diag = &replyMsg->body.diagnosticsReply;
+	diag->interpolPeriod = controller->interpolPeriod;
+	diag->lagCycleThreshold = controller->lagCycleThreshold_ms;
+	diag->lagQueueThreshold = controller->lagQueueThreshold_ms;
+	diag->ipCycleCnt = controller->ipCycleCnt;
+	diag->ipLateCycleCnt = controller->ipLateCycleCnt;
+	diag->ipMaxCycleInterval = controller->ipMaxCycleInterval_us;
+	diag->ipMaxExecTime = controller->ipMaxExecTime_us;
+	diag->producerLagCnt = controller->producerLagCnt;
+	diag->producerMinQueueTime = controller->producerMinQueueTime_ms;
+	diag->lagSignal = (controller->lagSignalHold > 0) ? 1 : 0;
+
+	if(bReset)
+		Ros_MotionServer_ResetLagStats(controller);
+
+	return OK;
+}
+
+
+//-----------------------------------------------------------------------
+// Processes message of type: ROS_MSG_MOTO_TRACE_READ
+// Copies a chunk of the trace, oldest entry first.  The trace must be
+// stopped to be read.
+//-----------------------------------------------------------------------
+int Ros_MotionServer_TraceRead(Controller* controller, SimpleMsg* receiveMsg, SimpleMsg* replyMsg)
+{
+	SmBodyMotoTraceData* trace;
+	int offset = receiveMsg->body.traceRead.offset;
+	int totalSize, oldest, copied, entryNo, entryOffset, n;
+
+	if(controller->traceBuffer == NULL)
+	{
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_FAILURE, 0, replyMsg, 0);
+		return 0;
+	}
+	if(controller->traceState != ROS_TRACE_STOPPED)
+	{
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, 0);
+		return 0;
+	}
+
+	totalSize = controller->traceCnt * controller->traceEntrySize;
+	if(offset < 0 || offset > totalSize)
+	{
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA, replyMsg, 0);
+		return 0;
+	}
+
+	//initialize memory
+	memset(replyMsg, 0x00, sizeof(SimpleMsg));
+
+	trace = &replyMsg->body.traceData;
+	trace->state = controller->traceState;
+	trace->numGroup = controller->numGroup;
+	trace->entrySize = controller->traceEntrySize;
+	trace->numEntries = controller->traceCnt;
+	trace->offset = offset;
+	trace->size = min(ROS_MAX_TRACE_DATA, totalSize - offset);
+
+	// Oldest entry is overwritten once the buffer is full
+	oldest = (controller->traceCnt < TRACE_BUFFER_SIZE) ? 0 : controller->traceIdx;
+	for(copied = 0; copied < trace->size; copied += n)
+	{
+		entryNo = (offset + copied) / controller->traceEntrySize;
+		entryOffset = (offset + copied) % controller->traceEntrySize;
+		n = min(controller->traceEntrySize - entryOffset, trace->size - copied);
+		memcpy(&trace->data[copied], 
+			controller->traceBuffer + (Q_OFFSET_IDX(oldest, entryNo, TRACE_BUFFER_SIZE) * controller->traceEntrySize) + entryOffset, n);
+	}
+
+	// set prefix: length of message excluding the prefix (only the data copied)
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoTraceData) - ROS_MAX_TRACE_DATA + trace->size;
+
+	// set header information of the reply
+	replyMsg->header.msgType = ROS_MSG_MOTO_TRACE_DATA;
+	replyMsg->header.commType = ROS_COMM_SERVICE_REPLY;
+	replyMsg->header.replyType = ROS_REPLY_SUCCESS;
+
+	return OK;
+}
+
+
+//-----------------------------------------------------------------------
+// Processes message of type: ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX
+// Return -1=Failure; 0=Success; 1=CloseConnection; 
+//-----------------------------------------------------------------------
+int Ros_MotionServer_JointTrajPtFullExProcess(Controller* controller, SimpleMsg* receiveMsg, 
+											  SimpleMsg* replyMsg)
+{
+	SmBodyJointTrajPtFullEx* msgBody;	
+	CtrlGroup* ctrlGroup;
+	int ret, i;
+
+	msgBody = &receiveMsg->body.jointTrajDataEx;
+
+	// Check if controller is able to receive incremental move and if the incremental move thread is running
+	if(!Ros_Controller_IsMotionReady(controller))
+	{
+		int subcode = Ros_Controller_GetNotReadySubcode(controller);
+		printf("ERROR: Controller is not ready (code: %d).  Can't process ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX.\r\n", subcode);
+		for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_NOT_READY, subcode, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+		}
+		return 0;
+	}
+
+	// A new trajectory wouldn't move while paused
+	if(msgBody->sequence == 0 && Ros_MotionServer_IsPaused(controller))
+	{
+		printf("ERROR: Motion is paused.  Can't start a trajectory with ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX.\r\n");
+		for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_NOT_READY, ROS_RESULT_NOT_READY_PAUSED, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+		}
+		return 0;
+	}
+
+	// Pre-check to ensure no groups are busy
+	for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+	{
+		if (Ros_Controller_IsValidGroupNo(controller, msgBody->jointTrajPtData[i].groupNo))
+		{
+			ctrlGroup = controller->ctrlGroups[msgBody->jointTrajPtData[i].groupNo];
+			if (ctrlGroup->hasDataToProcess)
+			{
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+				return 0;
+			}
+		}
+		else
+		{
+			printf("ERROR: GroupNo %d is not valid\n", msgBody->jointTrajPtData[i].groupNo);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_GROUPNO, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+			return 0;
+		}
+			
+		// Check that minimum information (time, position, velocity) is valid
+		if( (msgBody->jointTrajPtData[i].validFields & 0x07) != 0x07 )
+		{
+			printf("ERROR: Validfields = %d\r\n", msgBody->jointTrajPtData[i].validFields);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA_INSUFFICIENT, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < msgBody->numberOfValidGroups; i += 1)
+	{
+		ctrlGroup = controller->ctrlGroups[msgBody->jointTrajPtData[i].groupNo];
+		
+		// Check the trajectory sequence code
+		if(msgBody->sequence == 0) // First trajectory point
+		{
+			// Initialize first point variables
+			ret = Ros_MotionServer_InitTrajPointFullEx(ctrlGroup, &msgBody->jointTrajPtData[i], msgBody->sequence);
+		
+			// set reply
+			if(ret == 0)
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+			else
+			{
+				printf("ERROR: Ros_MotionServer_InitTrajPointFullEx returned %d\n", ret);
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ret, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+				return 0; //stop processing other groups in this loop
+			}
+		}
+		else if(msgBody->sequence > 0)// Subsequent trajectory points
+		{
+			// Add the point to the trajectory
+			ret = Ros_MotionServer_AddTrajPointFullEx(ctrlGroup, &msgBody->jointTrajPtData[i], msgBody->sequence);
+		
+			// ser reply
+			if(ret == 0)
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+			else if(ret == 1)
+			{
+				printf("ERROR: Ros_MotionServer_AddTrajPointFullEx returned %d\n", ret);
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+				return 0; //stop processing other groups in this loop
+			}
+			else
+			{
+				printf("ERROR: Ros_MotionServer_AddTrajPointFullEx returned %d\n", ret);
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ret, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+				return 0; //stop processing other groups in this loop
+			}
+		}
+		else
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_SEQUENCE, replyMsg, msgBody->jointTrajPtData[i].groupNo);
+			return 0; //stop processing other groups in this loop
+		}
+	}
+
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------
+// Processes message of type: ROS_MSG_MOTO_MOTION_CTRL
+// Return -1=Failure; 0=Success; 1=CloseConnection; 
+//-----------------------------------------------------------------------
+int Ros_MotionServer_MotionCtrlProcess(Controller* controller, SimpleMsg* receiveMsg, 
+										SimpleMsg* replyMsg)
+{
+	SmBodyMotoMotionCtrl* motionCtrl;
+
+	//printf("In MotionCtrlProcess\r\n");
+
+	// Check the command code
+	motionCtrl = &receiveMsg->body.motionCtrl;
+	switch(motionCtrl->command)
 	{
 		case ROS_CMD_CHECK_MOTION_READY: 
 		{
@@ -804,6 +1323,117 @@ int Ros_MotionServer_MotionCtrlProcess(Controller* controller, SimpleMsg* receiv
 				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_FAILURE, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
 			break;
 		}
+		case ROS_CMD_PAUSE_MOTION:
+		{
+			// Decelerate to a standstill without discarding the trajectory (subcode is the ramp time in ms)
+			int rampTime;
+			if(!(motionCtrl->data[0] <= MOTION_MAX_RAMP_TIME / 1000.0f))
+			{
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+				break;
+			}
+			rampTime = Ros_MotionServer_PauseMotion(controller, motionCtrl->data[0]);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, rampTime, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_RESUME_MOTION:
+		{
+			// Re-accelerate along the queued trajectory (subcode is the ramp time in ms)
+			int rampTime;
+			if(!(motionCtrl->data[0] <= MOTION_MAX_RAMP_TIME / 1000.0f))
+			{
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+				break;
+			}
+			rampTime = Ros_MotionServer_ResumeMotion(controller, motionCtrl->data[0]);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, rampTime, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_SPLICE_TRAJ:
+		{
+			JointMotionData spliceData;
+			int ret;
+
+			if(!Ros_Controller_IsValidGroupNo(controller, motionCtrl->groupNo))
+			{
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_GROUPNO, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+				break;
+			}
+
+			ret = Ros_MotionServer_SpliceTraj(controller, motionCtrl->groupNo, (int)(motionCtrl->data[0] * 1000), &spliceData);
+			if(ret == 0)
+			{
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, spliceData.time, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+				memcpy(replyMsg->body.motionReply.data, spliceData.pos, sizeof(float) * min(ROS_MAX_JOINT, MP_GRP_AXES_NUM));
+				memcpy(replyMsg->body.motionReply.data2, spliceData.vel, sizeof(float) * min(ROS_MAX_JOINT, MP_GRP_AXES_NUM));
+			}
+			else if(ret == ROS_RESULT_BUSY)
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_BUSY, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			else
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_NOT_READY, ret, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_SET_LAG_THRESHOLDS:
+		{
+			// Thresholds are received in seconds
+			if(motionCtrl->data[0] >= 0.0f)
+				controller->lagCycleThreshold_ms = (int)(motionCtrl->data[0] * 1000);
+			if(motionCtrl->data[1] >= 0.0f)
+				controller->lagQueueThreshold_ms = (int)(motionCtrl->data[1] * 1000);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_SET_START_THRESHOLD:
+		{
+			// Threshold is received in seconds
+			controller->startThreshold_ms = max(0, (int)(motionCtrl->data[0] * 1000));
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_SET_RIDE_THROUGH:
+		{
+			// Margin is received in seconds
+			if(motionCtrl->data[1] > 0.0f)
+				controller->rideThroughMargin_ms = (int)(motionCtrl->data[1] * 1000);
+			else
+				controller->rideThroughMargin_ms = RIDE_THROUGH_MARGIN;
+			controller->bRideThrough = (motionCtrl->data[0] != 0.0f);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_SET_MOTION_REPLY_EX:
+		{
+			controller->bMotionReplyEx = (motionCtrl->data[0] != 0.0f);
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_TRACE_START:
+		{
+			if(controller->traceBuffer == NULL)
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_FAILURE, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			else
+			{
+				Ros_MotionServer_TraceStart(controller);
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			}
+			break;
+		}
+		case ROS_CMD_TRACE_STOP:
+		{
+			controller->traceState = ROS_TRACE_STOPPED;
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
+		case ROS_CMD_TRACE_TRIGGER:
+		{
+			// Post-trigger time is received in seconds (subcode is the number of cycles recorded after the trigger)
+			int postTrigger = Ros_MotionServer_TraceTrigger(controller, (int)(motionCtrl->data[0] * 1000));
+			if(postTrigger > 0)
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, postTrigger, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			else
+				Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_FAILURE, 0, replyMsg, receiveMsg->body.motionCtrl.groupNo);
+			break;
+		}
 		case ROS_CMD_START_SERVOS:
 		{
 			// Stop Motion
@@ -903,6 +1533,163 @@ BOOL Ros_MotionServer_StopMotion(Controller* controller)
 }
 
 
+//-----------------------------------------------------------------------
+// Controlled stop: ramp the trajectory time down to a standstill.
+// The queued trajectory is kept so that it can be resumed.
+// rampTime in seconds (<=0 to use the default ramp, at most
+// MOTION_MAX_RAMP_TIME).  Returns the ramp time in ms.
+//-----------------------------------------------------------------------
+int Ros_MotionServer_PauseMotion(Controller* controller, float rampTime)
+{
+	int rampTime_ms;
+
+	if(rampTime > 0.0f)
+		rampTime_ms = (int)(rampTime * 1000);
+	else
+		rampTime_ms = Ros_MotionServer_GetSpeedRampTime(controller);
+
+	controller->bRideThroughActive = FALSE;
+	Ros_MotionServer_SetSpeedScale(controller, 0.0f, rampTime_ms);
+	return rampTime_ms;
+}
+
+
+//-----------------------------------------------------------------------
+// Ramp the trajectory time back up to nominal speed after a pause.
+// rampTime in seconds (<=0 to use the default ramp, at most
+// MOTION_MAX_RAMP_TIME).  Returns the ramp time in ms.
+//-----------------------------------------------------------------------
+int Ros_MotionServer_ResumeMotion(Controller* controller, float rampTime)
+{
+	int rampTime_ms;
+
+	if(rampTime > 0.0f)
+		rampTime_ms = (int)(rampTime * 1000);
+	else
+		rampTime_ms = Ros_MotionServer_GetSpeedRampTime(controller);
+
+	controller->bRideThroughActive = FALSE;
+	Ros_MotionServer_SetSpeedScale(controller, 1.0f, rampTime_ms);
+	return rampTime_ms;
+}
+
+
+//-----------------------------------------------------------------------
+// Check if the motion is paused (or being paused) by ROS_CMD_PAUSE_MOTION.
+// It stays paused until ROS_CMD_RESUME_MOTION or the queues are cleared.
+//-----------------------------------------------------------------------
+BOOL Ros_MotionServer_IsPaused(Controller* controller)
+{
+	return (!controller->bRideThroughActive && (controller->speedScaleTarget < 1.0f));
+}
+
+
+//-----------------------------------------------------------------------
+// Splice the trajectory of a group: the queued increments after the
+// requested time and the point being interpolated are dropped so that the
+// trajectory can continue with new points without stopping.
+// The splice happens at the first queued increment ending at or after
+// spliceTime_ms (or at the end of the queued motion if it ends before).
+// spliceData returns the trajectory state (ROS joint order) at the splice.
+// Returns 0 on success, ROS_RESULT_BUSY or a not ready subcode otherwise.
+//-----------------------------------------------------------------------
+int Ros_MotionServer_SpliceTraj(Controller* controller, int groupNo, int spliceTime_ms, JointMotionData* spliceData)
+{
+	CtrlGroup* ctrlGroup = controller->ctrlGroups[groupNo];
+	Incremental_q* q = &ctrlGroup->inc_q;
+	Incremental_data* entry;
+	int keepCnt, i, axis, remainder;
+	int ret = 0;
+
+	if(!Ros_Controller_IsMotionReady(controller))
+		return Ros_Controller_GetNotReadySubcode(controller);
+
+	// Abort the interpolation of the point being processed and wait for the
+	// AddToIncQueue task to release it
+	ctrlGroup->bSpliceTraj = TRUE;
+	for(i=0; ctrlGroup->hasDataToProcess && (i<MOTION_STOP_TIMEOUT); i++)
+		Ros_Sleep(controller->interpolPeriod);
+
+	if(ctrlGroup->hasDataToProcess)
+	{
+		printf("ERROR: Unable to splice trajectory.  Group %d is still processing a point.\r\n", groupNo);
+		ctrlGroup->bSpliceTraj = FALSE;
+		return ROS_RESULT_BUSY;
+	}
+
+	// Lock the q so that the IP task only sees the queue before or after the splice
+	if(mpSemTake(q->q_lock, (Q_LOCK_TIMEOUT / mpGetRtc())) == OK)
+	{
+		// Keep the increments up to the first one reaching the splice time
+		for(keepCnt=0; keepCnt<q->cnt; keepCnt++)
+		{
+			if(q->data[Q_OFFSET_IDX(q->idx, keepCnt, Q_SIZE)].time >= spliceTime_ms)
+			{
+				keepCnt++;
+				break;
+			}
+		}
+
+		// Remove the dropped increments from the end position of the queue
+		// (last one first: their IO actions are put back in order before the pending ones)
+		for(i=q->cnt-1; i>=keepCnt; i--)
+		{
+			entry = &q->data[Q_OFFSET_IDX(q->idx, i, Q_SIZE)];
+			for(axis=0; axis<MP_GRP_AXES_NUM; axis++)
+				ctrlGroup->prevPulsePos[axis] -= entry->inc[axis];
+
+			// Their IO actions are attached again to the spliced trajectory
+			Ros_MotionServer_PendIoActions(ctrlGroup, entry);
+		}
+		q->cnt = keepCnt;
+
+		// Restart the interpolation from the state at the end of the queue
+		if(q->cnt > 0)
+		{
+			entry = &q->data[Q_OFFSET_IDX(q->idx, q->cnt - 1, Q_SIZE)];
+			ctrlGroup->jointMotionData.time = entry->time;
+			memcpy(ctrlGroup->jointMotionData.pos, entry->pos, sizeof(ctrlGroup->jointMotionData.pos));
+			memcpy(ctrlGroup->jointMotionData.vel, entry->vel, sizeof(ctrlGroup->jointMotionData.vel));
+		}
+		else
+		{
+			// Queued motion already completed, continue at standstill from the
+			// current command position (like the start of a trajectory)
+			Ros_CtrlGroup_GetPulsePosCmd(ctrlGroup, ctrlGroup->prevPulsePos);
+			Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, ctrlGroup->prevPulsePos, ctrlGroup->jointMotionData.pos);
+			memset(ctrlGroup->jointMotionData.vel, 0x00, sizeof(ctrlGroup->jointMotionData.vel));
+			ctrlGroup->jointMotionData.time = ctrlGroup->q_time;
+		}
+		memset(ctrlGroup->jointMotionData.acc, 0x00, sizeof(ctrlGroup->jointMotionData.acc));
+
+		// Keep the following increments on the interpolation periods of the trajectory
+		remainder = (ctrlGroup->jointMotionData.time - ctrlGroup->trajStartTime_ms) % controller->interpolPeriod;
+		ctrlGroup->timeLeftover_ms = (remainder > 0) ? (controller->interpolPeriod - remainder) : 0;
+
+		memcpy(spliceData, &ctrlGroup->jointMotionData, sizeof(JointMotionData));
+
+		// Unlock the q
+		mpSemGive(q->q_lock);
+	}
+	else
+	{
+		printf("ERROR: Unable to splice trajectory.  Queue is locked up!\r\n");
+		ret = ROS_RESULT_BUSY;
+	}
+
+	ctrlGroup->bSpliceTraj = FALSE;
+
+	// Positions are kept with the B-axis compensation of the interpolation, remove it for ROS
+	if((ret == 0) && ctrlGroup->bIsBaxisSlave)
+	{
+		spliceData->pos[3] -= -spliceData->pos[1] + spliceData->pos[2];
+		spliceData->vel[3] -= -spliceData->vel[1] + spliceData->vel[2];
+	}
+
+	return ret;
+}
+
+
 //#define TEST_USETOOL
 //-----------------------------------------------------------------------
 // Sets servo power to ON or OFF
@@ -1293,9 +2080,9 @@ int Ros_MotionServer_JointTrajDataProcess(Controller* controller, SimpleMsg* rec
 	SmBodyJointTrajPtFull* trajData;
 	CtrlGroup* ctrlGroup;
 	int ret, i;
-    long pulsePos[MAX_PULSE_AXES]; // for feedback pos
+    FeedbackSample fbSample; // feedback pos, velocity and torque
     float radPos[MAX_PULSE_AXES];
-    double torqueValues[MAX_PULSE_AXES];
+    float radVel[MAX_PULSE_AXES];
     
 	// Check if controller is able to receive incremental move and if the incremental move thread is running
 	if(!Ros_Controller_IsMotionReady(controller))
@@ -1330,12 +2117,10 @@ int Ros_MotionServer_JointTrajDataProcess(Controller* controller, SimpleMsg* rec
 
     USHORT ioValue=0;
     if( trajData->validFields & 0x10 ) {
-        int apiRet;
-    	MP_IO_INFO ioReadInfo;
-	    ioReadInfo.ulAddr = trajData->ioReadAddress;
-    	apiRet = mpReadIO(&ioReadInfo, &ioValue, 1);
-        
-    	if (apiRet != OK) {
+        // Read now, unless the client accepts a value as recent as the feedback of the reply
+        // (validFields & 128: IO cache refreshed with the snapshot of the last interpolation cycle)
+    	if (!Ros_Controller_ReadIOCached(controller, trajData->ioReadAddress, &ioValue, 
+    			(trajData->validFields & 0x80) ? controller->interpolPeriod : 0)) {
     		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_MP_FAILURE, ROS_RESULT_INVALID_READIO, replyMsg, receiveMsg->body.jointTrajData.groupNo);
     		return 0;
         }
@@ -1343,26 +2128,32 @@ int Ros_MotionServer_JointTrajDataProcess(Controller* controller, SimpleMsg* rec
         //printf("read io %d=%d\n", trajData->ioReadAddress, (int)ioValue);
     }
 
-    // need to read the current encoder position
-   	ret = Ros_CtrlGroup_GetFBPulsePos(ctrlGroup, pulsePos);
+    // need the current encoder position and torque values (feedback snapshot of this cycle)
+   	ret = Ros_Controller_GetFeedbackSample(controller, trajData->groupNo, &fbSample);
 
    	if(ret!=TRUE) {
         Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_MP_FAILURE, ROS_RESULT_INVALID_GETFBPULSEPOS, replyMsg, receiveMsg->body.jointTrajData.groupNo);
 		return 0;
     }
-	Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, pulsePos, radPos);
-
-    // need to read the current torque values
-    Ros_CtrlGroup_GetTorque(ctrlGroup, torqueValues);
+	Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, fbSample.pulsePos, radPos);
+	Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, fbSample.pulseSpeed, radVel);
         
 	// Check the trajectory sequence code
 	if(trajData->sequence == 0) // First trajectory point
 	{
-		// Initialize first point variables
-		ret = Ros_MotionServer_InitTrajPointFull(ctrlGroup, trajData);
+		// Initialize first point variables (a new trajectory wouldn't move while paused)
+		if(Ros_MotionServer_IsPaused(controller))
+		{
+			printf("ERROR: Motion is paused.  Can't start a trajectory with ROS_MSG_JOINT_TRAJ_PT_FULL.\r\n");
+			ret = ROS_RESULT_NOT_READY_PAUSED;
+		}
+		else
+			ret = Ros_MotionServer_InitTrajPointFull(ctrlGroup, trajData);
 		
 		// set reply
-		if(ret == 0)
+		if(ret == ROS_RESULT_NOT_READY_PAUSED)
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_NOT_READY, ret, replyMsg, receiveMsg->body.jointTrajData.groupNo);
+		else if(ret == 0)
 			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, receiveMsg->body.jointTrajData.groupNo);
 		else
 			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ret, replyMsg, receiveMsg->body.jointTrajData.groupNo);
@@ -1390,12 +2181,13 @@ int Ros_MotionServer_JointTrajDataProcess(Controller* controller, SimpleMsg* rec
 	    replyMsg->body.motionReply.ioValue = ioValue;
 	}
 
-    replyMsg->body.motionReply.powerOnTimeStamp = mpGetRtc();
+    replyMsg->body.motionReply.powerOnTimeStamp = fbSample.time.sec * 1000U + fbSample.time.usec / 1000U;	// UINT32 arithmetic: wraps modulo 2^32
     
     memcpy(replyMsg->body.motionReply.data, radPos, sizeof(radPos));
     for(i = 0; i < MAX_PULSE_AXES; ++i) {
-        replyMsg->body.motionReply.data2[i] = torqueValues[i];
+        replyMsg->body.motionReply.data2[i] = fbSample.torque[i];
     }
+    memcpy(replyMsg->body.motionReplyEx.data3, radVel, sizeof(radVel));
     
 	return 0;
 }
@@ -1410,7 +2202,7 @@ int Ros_MotionServer_InitTrajPointFullEx(CtrlGroup* ctrlGroup, SmBodyJointTrajPt
 	//convert SmBodyMotoJointTrajPtExData data to SmBodyJointTrajPtFull
 	jointTrajData.groupNo = jointTrajDataEx->groupNo;
 	jointTrajData.sequence = sequence;
-	jointTrajData.validFields = jointTrajDataEx->validFields;
+	jointTrajData.validFields = jointTrajDataEx->validFields & ~(0x40 | 0x80);	// IO actions and IO read are only carried by ROS_MSG_JOINT_TRAJ_PT_FULL
 	jointTrajData.time = jointTrajDataEx->time;
 	memcpy(jointTrajData.pos, jointTrajDataEx->pos, sizeof(float)*ROS_MAX_JOINT);
 	memcpy(jointTrajData.vel, jointTrajDataEx->vel, sizeof(float)*ROS_MAX_JOINT);
@@ -1427,6 +2219,7 @@ int Ros_MotionServer_InitTrajPointFull(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFu
 	long trajPulsePos[MAX_PULSE_AXES], pulseFBPos[MAX_PULSE_AXES];
 	long curCommandedPos[MAX_PULSE_AXES];
 	int i;
+	int ret;
 
 	if(ctrlGroup->groupNo == jointTrajData->groupNo)
 	{
@@ -1434,6 +2227,8 @@ int Ros_MotionServer_InitTrajPointFull(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFu
 		Ros_MotionServer_ConvertToJointMotionData(jointTrajData, &ctrlGroup->jointMotionData);
 		ctrlGroup->timeLeftover_ms = 0;
 		ctrlGroup->q_time = ctrlGroup->jointMotionData.time;
+		ctrlGroup->trajStartTime_ms = ctrlGroup->jointMotionData.time;
+		ctrlGroup->bTrajEndReceived = FALSE;
 	
 		// Convert start position to pulse format
 		Ros_CtrlGroup_ConvertToMotoPos(ctrlGroup, ctrlGroup->jointMotionData.pos, trajPulsePos);
@@ -1466,6 +2261,17 @@ int Ros_MotionServer_InitTrajPointFull(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFu
 			}
 		}
 		
+		// IO actions of the new trajectory (the ones of the previous trajectory not sent are discarded)
+		if(ctrlGroup->numPendingIo > 0)
+			printf("WARNING: %d IO actions of the previous trajectory were not written (group %d)\r\n", ctrlGroup->numPendingIo, ctrlGroup->groupNo);
+		ctrlGroup->numPendingIo = 0;
+		ret = Ros_MotionServer_AddTrajIoActions(ctrlGroup, jointTrajData);
+		if(ret != 0)
+			return ret;
+
+		// Hold the start of the motion until the start threshold is buffered
+		ctrlGroup->bPrefillHold = TRUE;
+
 		//printf("Trajectory Start Initialized\r\n");
 		// Return success
 		return 0;
@@ -1484,7 +2290,7 @@ int Ros_MotionServer_AddTrajPointFullEx(CtrlGroup* ctrlGroup, SmBodyJointTrajPtE
 	//convert SmBodyMotoJointTrajPtExData data to SmBodyJointTrajPtFull
 	jointTrajData.groupNo = jointTrajDataEx->groupNo;
 	jointTrajData.sequence = sequence;
-	jointTrajData.validFields = jointTrajDataEx->validFields;
+	jointTrajData.validFields = jointTrajDataEx->validFields & ~(0x40 | 0x80);	// IO actions and IO read are only carried by ROS_MSG_JOINT_TRAJ_PT_FULL
 	jointTrajData.time = jointTrajDataEx->time;
 	memcpy(jointTrajData.pos, jointTrajDataEx->pos, sizeof(float)*ROS_MAX_JOINT);
 	memcpy(jointTrajData.vel, jointTrajDataEx->vel, sizeof(float)*ROS_MAX_JOINT);
@@ -1500,6 +2306,7 @@ int Ros_MotionServer_AddTrajPointFullEx(CtrlGroup* ctrlGroup, SmBodyJointTrajPtE
 int Ros_MotionServer_AddTrajPointFull(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFull* jointTrajData)
 {
 	int i;
+	int ret;
 	JointMotionData jointData;
 
 	// Check that there isn't data current being processed
@@ -1533,9 +2340,16 @@ int Ros_MotionServer_AddTrajPointFull(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFul
 		}
 	}			
 
+	// IO actions are handed over with the point (the AddToIncQueue task is idle)
+	ret = Ros_MotionServer_AddTrajIoActions(ctrlGroup, jointTrajData);
+	if(ret != 0)
+		return ret;
+
 	// Store of the message trajectory data to the control group for processing 
 	memcpy(&ctrlGroup->jointMotionDataToProcess, &jointData, sizeof(JointMotionData));
 	ctrlGroup->hasDataToProcess = TRUE;
+	if(jointTrajData->validFields & 0x20)
+		ctrlGroup->bTrajEndReceived = TRUE;
 
 	return 0;
 }
@@ -1609,6 +2423,7 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 	float interpolTime;      			// time increment in second
 	long newPulsePos[MP_GRP_AXES_NUM];
 	Incremental_data incData;
+	BOOL bTrajEnd;						// increment reaching the last point of the trajectory
 
 	//printf("Starting JointTrajDataProcess\r\n");	
 
@@ -1659,7 +2474,7 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 		timeInc_ms = ctrlGroup->timeLeftover_ms;
 		
 	// While interpolation time is smaller than new ROS point time
-	while( (curTrajData->time < endTrajData->time) && Ros_Controller_IsMotionReady(controller) && !controller->bStopMotion)
+	while( (curTrajData->time < endTrajData->time) && Ros_Controller_IsMotionReady(controller) && !controller->bStopMotion && !ctrlGroup->bSpliceTraj)
 	{
 		// Increment calculation time by next time increment
 		calculationTime_ms += timeInc_ms;
@@ -1722,6 +2537,8 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 		
 		// Calculate the increment
 		incData.time = curTrajData->time;
+		memcpy(incData.pos, curTrajData->pos, sizeof(incData.pos));
+		memcpy(incData.vel, curTrajData->vel, sizeof(incData.vel));
 		for (i = 0; i < MP_GRP_AXES_NUM; i++)
 		{
 			if (ctrlGroup->axisType.type[i] != AXIS_INVALID)
@@ -1730,12 +2547,18 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 				incData.inc[i] = 0;
 		}
 		
+		// IO actions due when the increment is reached (all the remaining ones at the end of the trajectory)
+		bTrajEnd = ctrlGroup->bTrajEndReceived && (curTrajData->time >= endTrajData->time);
+		Ros_MotionServer_AttachIoActions(ctrlGroup, &incData, bTrajEnd);
+		
 		// Add the increment to the queue
 		if(!Ros_MotionServer_AddPulseIncPointToQ(controller, groupNo, &incData)) {
 //            printf("missed %d: %d, %d, %d, %d, %d, %d, %d\r\n", incData.time,
 //			incData.inc[0], incData.inc[1], incData.inc[2],
 //			incData.inc[3], incData.inc[4], incData.inc[5],
 //			incData.inc[6]);
+			// The IO actions of the increment wait for the next one
+			Ros_MotionServer_PendIoActions(ctrlGroup, &incData);
 			break;
         }
 
@@ -1746,6 +2569,22 @@ void Ros_MotionServer_JointTrajDataToIncQueue(Controller* controller, int groupN
 
 		// Copy data to the previous pulse position for next iteration
 		memcpy(ctrlGroup->prevPulsePos, newPulsePos, sizeof(ctrlGroup->prevPulsePos));
+
+		// IO actions that don't fit in the last increment of the trajectory are
+		// sent with extra increments without motion (one interpolation period each)
+		if(bTrajEnd && (ctrlGroup->numPendingIo > 0))
+		{
+			memset(incData.inc, 0x00, sizeof(incData.inc));
+			while(ctrlGroup->numPendingIo > 0)
+			{
+				Ros_MotionServer_AttachIoActions(ctrlGroup, &incData, TRUE);
+				if(!Ros_MotionServer_AddPulseIncPointToQ(controller, groupNo, &incData))
+				{
+					Ros_MotionServer_PendIoActions(ctrlGroup, &incData);
+					break;
+				}
+			}
+		}
 	}
 }
 
@@ -1770,6 +2609,12 @@ BOOL Ros_MotionServer_AddPulseIncPointToQ(Controller* controller, int groupNo, I
 		{
 			return FALSE;
 		}
+
+		// the trajectory is being spliced, the point won't be used
+		if (controller->ctrlGroups[groupNo]->bSpliceTraj)
+		{
+			return FALSE;
+		}
 	}
 	
 	// Lock the q before manipulating it
@@ -1814,6 +2659,9 @@ BOOL Ros_MotionServer_ClearQ(Controller* controller, int groupNo)
 	{
 		// Reset the queue.  No need to modify index or delete data
 		q->cnt = 0;
+		controller->ctrlGroups[groupNo]->bPrefillHold = FALSE;
+		controller->ctrlGroups[groupNo]->q_partialTime = 0;
+		memset(controller->ctrlGroups[groupNo]->q_partialInc, 0x00, sizeof(controller->ctrlGroups[groupNo]->q_partialInc));
 		
 		// Unlock the q
 		mpSemGive(q->q_lock);
@@ -1837,6 +2685,10 @@ BOOL Ros_MotionServer_ClearQ_All(Controller* controller)
 	{
 		bRet &= Ros_MotionServer_ClearQ(controller, groupNo);
 	}
+
+	// Nothing left to pause or resume
+	controller->bRideThroughActive = FALSE;
+	Ros_MotionServer_SetSpeedScale(controller, 1.0f, 0);
 		
 	return bRet;
 }
@@ -1874,6 +2726,106 @@ int Ros_MotionServer_GetQueueCnt(Controller* controller, int groupNo)
 
 
 
+//-------------------------------------------------------------------
+// Get the motion time (ms) buffered for the specified group: time covered
+// by the inc_move queue plus the part of the pending point that hasn't
+// been interpolated yet (also returned in pendingTime if not NULL).
+// Returns -1 on failure.
+//-------------------------------------------------------------------
+int Ros_MotionServer_GetQueueTime(Controller* controller, int groupNo, int* queueFree, int* pendingTime)
+{
+	return Ros_MotionServer_ReadQueueTime(controller, groupNo, (Q_LOCK_TIMEOUT / mpGetRtc()), queueFree, pendingTime);
+}
+
+
+//-------------------------------------------------------------------
+// Same as Ros_MotionServer_GetQueueTime, waiting at most lockTimeout
+// ticks for the queue.  The IP task uses NO_WAIT: it doesn't block on
+// the queue and simply gets -1 if the queue is being updated.
+//-------------------------------------------------------------------
+int Ros_MotionServer_ReadQueueTime(Controller* controller, int groupNo, int lockTimeout, int* queueFree, int* pendingTime)
+{
+	CtrlGroup* ctrlGroup;
+	Incremental_q* q;
+	int queueTime = 0;
+	int pending = 0;
+	
+	// Check group number valid
+	if(!Ros_Controller_IsValidGroupNo(controller, groupNo))
+		return -1;
+
+	ctrlGroup = controller->ctrlGroups[groupNo];
+	q = &ctrlGroup->inc_q;
+	
+	// Lock the q before accessing it
+	if(mpSemTake(q->q_lock, lockTimeout) == OK)
+	{
+		if(q->cnt > 0)
+			queueTime = q->data[Q_OFFSET_IDX(q->idx, q->cnt - 1, Q_SIZE)].time - ctrlGroup->q_time - (int)ctrlGroup->q_partialTime;
+		if(queueFree != NULL)
+			*queueFree = Q_SIZE - q->cnt;
+
+		// Part of the pending point that is still to be interpolated (read with the
+		// queue so that the increments added in the meantime aren't counted twice)
+		if(ctrlGroup->hasDataToProcess)
+			pending = max(0, ctrlGroup->jointMotionDataToProcess.time - ctrlGroup->jointMotionData.time);
+			
+		// Unlock the q
+		mpSemGive(q->q_lock);
+	}
+	else
+	{
+		if(lockTimeout != NO_WAIT)
+			printf("ERROR: Unable to access queue time.  Queue is locked up!\r\n");
+		return -1;
+	}
+
+	if(pendingTime != NULL)
+		*pendingTime = pending;
+	
+	return max(0, queueTime + pending);
+}
+
+
+//-------------------------------------------------------------------
+// Convert a MOTO_MOTION_REPLY to a MOTO_MOTION_REPLY_EX with the queue
+// state of all groups so that the client doesn't have to retry blindly
+// when it gets ROS_RESULT_BUSY.
+// The IP task drains one interpolation period of motion per period, so
+// the pending point is accepted once the part of it that doesn't fit in
+// the free space of the queue has been drained.
+//-------------------------------------------------------------------
+void Ros_MotionServer_QueueStatusToReply(Controller* controller, SimpleMsg* replyMsg)
+{
+	int groupNo;
+	int queueFree;
+	int pendingTime;
+	int retryDelay = 0;
+	
+	replyMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoMotionReplyEx);
+	replyMsg->header.msgType = ROS_MSG_MOTO_MOTION_REPLY_EX;
+	
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		queueFree = 0;
+		pendingTime = 0;
+		replyMsg->body.motionReplyEx.queueTime[groupNo] = Ros_MotionServer_GetQueueTime(controller, groupNo, &queueFree, &pendingTime);
+		replyMsg->body.motionReplyEx.queueFree[groupNo] = queueFree;
+		
+		if(pendingTime > 0)
+		{
+			// Time left to interpolate minus what fits in the queue right away,
+			// plus one period for the AddToIncQueue task to pick up the next point
+			retryDelay = max(retryDelay, pendingTime - (queueFree * controller->interpolPeriod) + controller->interpolPeriod);
+		}
+	}
+	
+	replyMsg->body.motionReplyEx.retryDelay = retryDelay;
+	replyMsg->body.motionReplyEx.motionPaused = Ros_MotionServer_IsPaused(controller) ? 1 : 0;
+	replyMsg->body.motionReplyEx.speedScale = controller->speedScale;
+}
+
+
 //-------------------------------------------------------------------
 // Check that at least one control group of the controller has data in queue
 //-------------------------------------------------------------------
@@ -1883,11 +2835,60 @@ BOOL Ros_MotionServer_HasDataInQueue(Controller* controller)
 	
 	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
 	{
-		if(Ros_MotionServer_GetQueueCnt(controller, groupNo) > 0)
-			return TRUE;
+		if(Ros_MotionServer_GetQueueCnt(controller, groupNo) > 0)
+			return TRUE;
+	}
+		
+	return FALSE;
+}
+
+
+//-------------------------------------------------------------------
+// Check if the start of the trajectory is held to buffer motion (IP task).
+// A group is released when startThreshold_ms of motion is queued or when
+// the last point of its trajectory is interpolated.  All groups are
+// released when a queue is full since no more motion can be buffered.
+//-------------------------------------------------------------------
+BOOL Ros_MotionServer_IsPrefillHold(Controller* controller)
+{
+	CtrlGroup* ctrlGroup;
+	Incremental_q* q;
+	int queueTime;
+	BOOL bHold = FALSE;
+	BOOL bQueueFull = FALSE;
+	int groupNo;
+
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		ctrlGroup = controller->ctrlGroups[groupNo];
+		if(!ctrlGroup->bPrefillHold)
+			continue;
+
+		q = &ctrlGroup->inc_q;
+		queueTime = 0;
+		if(mpSemTake(q->q_lock, (Q_LOCK_TIMEOUT / mpGetRtc())) == OK)
+		{
+			if(q->cnt > 0)
+				queueTime = q->data[Q_OFFSET_IDX(q->idx, q->cnt - 1, Q_SIZE)].time - ctrlGroup->q_time;
+			bQueueFull |= (q->cnt >= Q_SIZE);
+			mpSemGive(q->q_lock);
+		}
+
+		if((queueTime >= controller->startThreshold_ms)
+			|| (ctrlGroup->bTrajEndReceived && !ctrlGroup->hasDataToProcess))
+			ctrlGroup->bPrefillHold = FALSE;
+		else
+			bHold = TRUE;
+	}
+
+	if(bHold && bQueueFull)
+	{
+		for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+			controller->ctrlGroups[groupNo]->bPrefillHold = FALSE;
+		bHold = FALSE;
 	}
-		
-	return FALSE;
+
+	return bHold;
 }
 
 
@@ -1909,11 +2910,18 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 	LONG time;
 	LONG q_time;
 	int axis;
+	ULONG cycleStartTick;
+	RosTime cycleStartTime;
+	RosTime prevCycleStartTime;
+	BOOL bMoved;
+	MP_IO_DATA ioWrite[Q_IO_ACTION_SIZE * MP_GRP_NUM];	// IO actions of the entries sent during the cycle
+	int numIoWrite;
 	//BOOL bNoData = TRUE;  // for testing
 	
 	printf("IncMoveTask Started\r\n");
 	
 	memset(&moveData, 0x00, sizeof(moveData));
+	memset(&prevCycleStartTime, 0x00, sizeof(prevCycleStartTime));
 
 	for(i=0; i<controller->numGroup; i++)
 	{
@@ -1924,12 +2932,23 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 	FOREVER
 	{
 		mpClkAnnounce(MP_INTERPOLATION_CLK);
+		cycleStartTick = tickGet();
+		
+		// Advance the pause/resume ramp
+		Ros_MotionServer_UpdateSpeedScale(controller);
 		
+		bMoved = FALSE;
 		if (Ros_Controller_IsMotionReady(controller) 
 			&& Ros_MotionServer_HasDataInQueue(controller) 
-			&& !controller->bStopMotion )
+			&& !controller->bStopMotion
+			&& !Ros_MotionServer_IsPrefillHold(controller) )
 		{
 			//bNoData = FALSE;   // for testing
+			bMoved = TRUE;
+
+			// Slow down if the queued motion is running out
+			Ros_MotionServer_RideThrough(controller);
+			numIoWrite = 0;
 			
 			for(i=0; i<controller->numGroup; i++)
 			{
@@ -1938,7 +2957,18 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 				// Lock the q before manipulating it
 				if(mpSemTake(q->q_lock, (Q_LOCK_TIMEOUT / mpGetRtc())) == OK)
 				{
-					if(q->cnt > 0)
+					if((controller->speedScale < 1.0f) || (controller->ctrlGroups[i]->q_partialTime > 0))
+					{
+						// Trajectory time is scaled (pause/resume), take the matching part of the queue
+						if(q->cnt > 0)
+						{
+							moveData.grp_pos_info[i].pos_tag.data[2] = q->data[q->idx].tool;
+							moveData.grp_pos_info[i].pos_tag.data[3] = q->data[q->idx].frame;
+							moveData.grp_pos_info[i].pos_tag.data[4] = q->data[q->idx].user;
+						}
+						Ros_MotionServer_GetScaledIncFromQ(controller, i, moveData.grp_pos_info[i].pos, ioWrite, &numIoWrite);
+					}
+					else if(q->cnt > 0)
 					{
 						time = q->data[q->idx].time;
 						q_time = controller->ctrlGroups[i]->q_time;
@@ -1947,6 +2977,7 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 						moveData.grp_pos_info[i].pos_tag.data[4] = q->data[q->idx].user;
 						
 						memcpy(&moveData.grp_pos_info[i].pos, &q->data[q->idx].inc, sizeof(LONG) * MP_GRP_AXES_NUM);
+						Ros_MotionServer_CollectIoActions(&q->data[q->idx], ioWrite, &numIoWrite);
 					
 						// increment index in the queue and decrease the count
 						q->idx = Q_OFFSET_IDX( q->idx, 1, Q_SIZE );
@@ -1972,6 +3003,7 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 								// add next incMove to current incMove
 								for(axis=0; axis<MP_GRP_AXES_NUM; axis++)
 									moveData.grp_pos_info[i].pos[axis] += q->data[q->idx].inc[axis];
+								Ros_MotionServer_CollectIoActions(&q->data[q->idx], ioWrite, &numIoWrite);
 								time = q->data[q->idx].time; 
 
 								// increment index in the queue and decrease the count
@@ -2041,6 +3073,10 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 			}
 #endif
 			
+			// IO actions of the trajectory points reached by this cycle
+			if(numIoWrite > 0)
+				Ros_MotionServer_WriteIoActions(ioWrite, &numIoWrite);
+			
 		}
 		//else  // for testing
 		//{
@@ -2050,10 +3086,557 @@ void Ros_MotionServer_IncMoveLoopStart(Controller* controller) //<-- IP_CLK prio
 		//		bNoData = TRUE;
 		//	}
 		//}
+
+		// Cycle timestamp, taken after the increment so that it doesn't delay it
+		Ros_Controller_GetTime(&cycleStartTime);
+
+		// Feedback snapshot shared by the motion replies and the state server
+		// (after the increment so that the reads don't delay it)
+		Ros_Controller_SampleFeedback(controller);
+
+		// IO read recently by the clients
+		Ros_Controller_RefreshIOCache(controller);
+
+		// Record the cycle in the trace
+		if(controller->traceState != ROS_TRACE_STOPPED)
+			Ros_MotionServer_TraceRecord(controller, &moveData, bMoved, cycleStartTick);
+
+		// Check that the cycle and the interpolation of the trajectory keep up with real time
+		Ros_MotionServer_LagMonitor(controller, &cycleStartTime, &prevCycleStartTime);
+		prevCycleStartTime = cycleStartTime;
+	}
+}
+
+
+
+//-------------------------------------------------------------------
+// Allocate the trace buffer (entries sized for the number of groups)
+//-------------------------------------------------------------------
+void Ros_MotionServer_TraceInit(Controller* controller)
+{
+	controller->traceState = ROS_TRACE_STOPPED;
+	controller->traceIdx = 0;
+	controller->traceCnt = 0;
+	controller->tracePostTrigger = 0;
+	controller->traceEntrySize = sizeof(SmMotoTraceEntry) + (sizeof(SmMotoTraceGroup) * controller->numGroup);
+	controller->traceBuffer = mpMalloc(TRACE_BUFFER_SIZE * controller->traceEntrySize);
+	if(controller->traceBuffer == NULL)
+		printf("Failed to allocate the trace buffer, trace not available\r\n");
+}
+
+
+//-------------------------------------------------------------------
+// Clear the trace and start recording
+//-------------------------------------------------------------------
+void Ros_MotionServer_TraceStart(Controller* controller)
+{
+	controller->traceState = ROS_TRACE_STOPPED;
+	controller->traceIdx = 0;
+	controller->traceCnt = 0;
+	controller->traceState = ROS_TRACE_RECORDING;
+}
+
+
+//-------------------------------------------------------------------
+// Stop recording the trace after postTrigger_ms (<= 0: half the trace)
+// Returns the number of cycles recorded after the trigger (0 = not recording)
+//-------------------------------------------------------------------
+int Ros_MotionServer_TraceTrigger(Controller* controller, int postTrigger_ms)
+{
+	int postTrigger;
+
+	if(controller->traceState != ROS_TRACE_RECORDING)
+		return 0;
+
+	if(postTrigger_ms > 0)
+		postTrigger = min(TRACE_BUFFER_SIZE, max(1, postTrigger_ms / controller->interpolPeriod));
+	else
+		postTrigger = TRACE_BUFFER_SIZE / 2;
+
+	controller->tracePostTrigger = postTrigger;
+	controller->traceState = ROS_TRACE_TRIGGERED;
+
+	return postTrigger;
+}
+
+
+//-------------------------------------------------------------------
+// Record the cycle in the trace (IP task): increments sent, command and
+// feedback positions of the snapshot and queue depth of each group
+//-------------------------------------------------------------------
+#if DX100
+void Ros_MotionServer_TraceRecord(Controller* controller, MP_POS_DATA* moveData, BOOL bMoved, ULONG cycleStartTick)
+#else
+void Ros_MotionServer_TraceRecord(Controller* controller, MP_EXPOS_DATA* moveData, BOOL bMoved, ULONG cycleStartTick)
+#endif
+{
+	SmMotoTraceEntry* entry;
+	SmMotoTraceGroup* traceGroup;
+	CtrlGroup* ctrlGroup;
+	int groupNo, axis;
+
+	if(controller->traceBuffer == NULL)
+		return;
+
+	entry = (SmMotoTraceEntry*)(controller->traceBuffer + (controller->traceIdx * controller->traceEntrySize));
+	entry->tick = cycleStartTick;
+	entry->cycle = controller->fbSnapshotCycle;
+
+	traceGroup = (SmMotoTraceGroup*)(entry + 1);
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++, traceGroup++)
+	{
+		ctrlGroup = controller->ctrlGroups[groupNo];
+		for(axis=0; axis<MAX_PULSE_AXES; axis++)
+		{
+			traceGroup->inc[axis] = (bMoved && axis < MP_GRP_AXES_NUM) ? moveData->grp_pos_info[groupNo].pos[axis] : 0;
+			traceGroup->cmdPos[axis] = ctrlGroup->fbSnapshot.cmdPulsePos[axis];
+			traceGroup->fbPos[axis] = ctrlGroup->fbSnapshot.pulsePos[axis];
+		}
+		traceGroup->queueCnt = ctrlGroup->inc_q.cnt;
+	}
+
+	controller->traceIdx = Q_OFFSET_IDX(controller->traceIdx, 1, TRACE_BUFFER_SIZE);
+	if(controller->traceCnt < TRACE_BUFFER_SIZE)
+		controller->traceCnt++;
+
+	if(controller->traceState == ROS_TRACE_TRIGGERED)
+	{
+		controller->tracePostTrigger--;
+		if(controller->tracePostTrigger <= 0)
+			controller->traceState = ROS_TRACE_STOPPED;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Real-time lag monitor (IP task).  Counts the IP cycles that start late
+// or execute longer than lagCycleThreshold_ms, and the cycles where a
+// group still has less than lagQueueThreshold_ms of motion buffered while
+// its pending point has had a full cycle to be interpolated.
+// Times are measured with the controller clock (Ros_Controller_GetTime)
+// from the cycle timestamp, taken right after the increment move.
+//-------------------------------------------------------------------
+void Ros_MotionServer_LagMonitor(Controller* controller, RosTime* cycleStartTime, RosTime* prevCycleStartTime)
+{
+	CtrlGroup* ctrlGroup;
+	RosTime now;
+	int execTime_us, cycleInterval_us, queueTime;
+	BOOL bLate = FALSE;
+	int groupNo;
+
+	Ros_Controller_GetTime(&now);
+	execTime_us = Ros_Controller_TimeDiff(cycleStartTime, &now);
+	controller->ipMaxExecTime_us = max(controller->ipMaxExecTime_us, execTime_us);
+	if(controller->lagCycleThreshold_ms > 0 && execTime_us > controller->lagCycleThreshold_ms * 1000)
+		bLate = TRUE;
+
+	if(controller->ipCycleCnt > 0)
+	{
+		cycleInterval_us = Ros_Controller_TimeDiff(prevCycleStartTime, cycleStartTime);
+		controller->ipMaxCycleInterval_us = max(controller->ipMaxCycleInterval_us, cycleInterval_us);
+		if(controller->lagCycleThreshold_ms > 0 && cycleInterval_us > (controller->interpolPeriod + controller->lagCycleThreshold_ms) * 1000)
+			bLate = TRUE;
+	}
+
+	controller->ipCycleCnt++;
+	if(bLate)
+		controller->ipLateCycleCnt++;
+
+	// Interpolation of the pending points (Ros_MotionServer_AddToIncQueueProcess)
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		ctrlGroup = controller->ctrlGroups[groupNo];
+		if(!ctrlGroup->hasDataToProcess || !Ros_Controller_IsMotionReady(controller) || controller->bStopMotion)
+		{
+			ctrlGroup->lowQueueCycles = 0;
+			continue;
+		}
+
+		// Don't wait for the queue in the IP task, the group is checked again next cycle
+		queueTime = Ros_MotionServer_ReadQueueTime(controller, groupNo, NO_WAIT, NULL, NULL);
+		if(queueTime < 0)
+			continue;
+		if(controller->producerMinQueueTime_ms < 0 || queueTime < controller->producerMinQueueTime_ms)
+			controller->producerMinQueueTime_ms = queueTime;
+
+		if(controller->lagQueueThreshold_ms > 0 && queueTime < controller->lagQueueThreshold_ms)
+		{
+			// A newly received point is allowed one cycle before being interpolated
+			ctrlGroup->lowQueueCycles++;
+			if(ctrlGroup->lowQueueCycles > 1)
+				controller->producerLagCnt++;
+		}
+		else
+			ctrlGroup->lowQueueCycles = 0;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Reset the statistics of the real-time lag monitor
+//-------------------------------------------------------------------
+void Ros_MotionServer_ResetLagStats(Controller* controller)
+{
+	controller->ipCycleCnt = 0;
+	controller->ipLateCycleCnt = 0;
+	controller->ipMaxCycleInterval_us = 0;
+	controller->ipMaxExecTime_us = 0;
+	controller->producerLagCnt = 0;
+	controller->producerMinQueueTime_ms = -1;
+	controller->lagCntReported = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Take from the queue the increments covering speedScale interpolation
+// periods of trajectory time.  When the period ends in the middle of an
+// entry, the matching fraction of its increments is sent and the rest is
+// kept for the next cycle.  The IO actions of the entries completed are
+// added to ioWrite.  The q must be locked by the caller.
+//-------------------------------------------------------------------
+void Ros_MotionServer_GetScaledIncFromQ(Controller* controller, int groupNo, LONG inc[MP_GRP_AXES_NUM], MP_IO_DATA ioWrite[], int* numIoWrite)
+{
+	CtrlGroup* ctrlGroup = controller->ctrlGroups[groupNo];
+	Incremental_q* q = &ctrlGroup->inc_q;
+	Incremental_data* head;
+	float timeLeft;		// trajectory time (ms) left to cover during this cycle
+	float duration;		// trajectory time (ms) covered by the entry at the head of the queue
+	LONG partInc;
+	int axis;
+
+	memset(inc, 0x00, sizeof(LONG) * MP_GRP_AXES_NUM);
+	timeLeft = controller->speedScale * controller->interpolPeriod;
+
+	while((q->cnt > 0) && (timeLeft > 0.0f))
+	{
+		head = &q->data[q->idx];
+		// An entry lasts at least one cycle (like when the queue isn't scaled), also
+		// when its time isn't after the previous one
+		duration = max((float)controller->interpolPeriod, (float)(head->time - ctrlGroup->q_time));
+
+		if(duration - ctrlGroup->q_partialTime <= timeLeft)
+		{
+			// Rest of the entry is covered by this cycle
+			for(axis=0; axis<MP_GRP_AXES_NUM; axis++)
+				inc[axis] += head->inc[axis] - ctrlGroup->q_partialInc[axis];
+			timeLeft -= duration - ctrlGroup->q_partialTime;
+			Ros_MotionServer_CollectIoActions(head, ioWrite, numIoWrite);
+
+			ctrlGroup->q_time = head->time;
+			ctrlGroup->q_partialTime = 0;
+			memset(ctrlGroup->q_partialInc, 0x00, sizeof(ctrlGroup->q_partialInc));
+
+			// increment index in the queue and decrease the count
+			q->idx = Q_OFFSET_IDX( q->idx, 1, Q_SIZE );
+			q->cnt--;
+		}
+		else
+		{
+			// Only part of the entry is covered, send the matching fraction of its increments
+			ctrlGroup->q_partialTime += timeLeft;
+			for(axis=0; axis<MP_GRP_AXES_NUM; axis++)
+			{
+				partInc = (LONG)(head->inc[axis] * ctrlGroup->q_partialTime / duration);
+				inc[axis] += partInc - ctrlGroup->q_partialInc[axis];
+				ctrlGroup->q_partialInc[axis] = partInc;
+			}
+			timeLeft = 0;
+		}
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Add the IO actions of a trajectory point (validFields & 64) to the
+// actions waiting for their increment to be queued.  Values are checked
+// like ROS_MSG_MOTO_WRITE_IO_LIST.
+// Returns 0 or the invalid subcode
+//-------------------------------------------------------------------
+int Ros_MotionServer_AddTrajIoActions(CtrlGroup* ctrlGroup, SmBodyJointTrajPtFull* jointTrajData)
+{
+	SmTrajIOAction* action;
+	int pointTime_ms;
+	int i;
+
+	if(!(jointTrajData->validFields & 0x40) || (jointTrajData->numIoActions == 0))
+		return 0;
+
+	if(ctrlGroup->numPendingIo + jointTrajData->numIoActions > PENDING_IO_ACTION_SIZE)
+	{
+		printf("ERROR: Too many pending IO actions (group %d)\r\n", ctrlGroup->groupNo);
+		return ROS_RESULT_INVALID_DATA;
+	}
+
+	for(i = 0; i < jointTrajData->numIoActions; i++)
+	{
+		action = &jointTrajData->ioAction[i];
+		if((action->ioAddress < ROS_IO_REGISTER_ADDRESS_MIN && action->ioValue > 1) || (action->ioValue > 0xFFFF))
+		{
+			printf("ERROR: Invalid IO action value (address %d, value %d)\r\n", action->ioAddress, action->ioValue);
+			return ROS_RESULT_INVALID_DATA;
+		}
+	}
+
+	pointTime_ms = (int)(jointTrajData->time * 1000);
+	for(i = 0; i < jointTrajData->numIoActions; i++)
+	{
+		action = &jointTrajData->ioAction[i];
+		ctrlGroup->pendingIoTime[ctrlGroup->numPendingIo] = pointTime_ms + action->timeOffset;
+		ctrlGroup->pendingIo[ctrlGroup->numPendingIo].ulAddr = action->ioAddress;
+		ctrlGroup->pendingIo[ctrlGroup->numPendingIo].ulValue = action->ioValue;
+		ctrlGroup->numPendingIo++;
+	}
+
+	return 0;
+}
+
+
+//-------------------------------------------------------------------
+// Attach to an increment the pending IO actions due at its time.  Actions
+// that don't fit are attached to the next increment (at the end of the
+// trajectory, they are left pending for the extra increments queued by
+// Ros_MotionServer_JointTrajDataToIncQueue).
+//-------------------------------------------------------------------
+void Ros_MotionServer_AttachIoActions(CtrlGroup* ctrlGroup, Incremental_data* incData, BOOL bTrajEnd)
+{
+	int i = 0;
+	int j;
+
+	incData->numIoActions = 0;
+	while((i < ctrlGroup->numPendingIo) && (incData->numIoActions < Q_IO_ACTION_SIZE))
+	{
+		if(bTrajEnd || (ctrlGroup->pendingIoTime[i] <= incData->time))
+		{
+			incData->ioAction[incData->numIoActions] = ctrlGroup->pendingIo[i];
+			incData->numIoActions++;
+
+			// Keep the order of the remaining actions
+			for(j = i + 1; j < ctrlGroup->numPendingIo; j++)
+			{
+				ctrlGroup->pendingIoTime[j - 1] = ctrlGroup->pendingIoTime[j];
+				ctrlGroup->pendingIo[j - 1] = ctrlGroup->pendingIo[j];
+			}
+			ctrlGroup->numPendingIo--;
+		}
+		else
+			i++;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Put back the IO actions of an increment that isn't queued (removed by
+// a splice or not added) in front of the pending actions, due at the
+// time of the increment
+//-------------------------------------------------------------------
+void Ros_MotionServer_PendIoActions(CtrlGroup* ctrlGroup, Incremental_data* entry)
+{
+	int num = entry->numIoActions;
+	int i;
+
+	if(ctrlGroup->numPendingIo + num > PENDING_IO_ACTION_SIZE)
+	{
+		printf("WARNING: %d IO actions dropped, too many pending actions (group %d)\r\n", 
+			ctrlGroup->numPendingIo + num - PENDING_IO_ACTION_SIZE, ctrlGroup->groupNo);
+		num = PENDING_IO_ACTION_SIZE - ctrlGroup->numPendingIo;
+	}
+
+	for(i = ctrlGroup->numPendingIo - 1; i >= 0; i--)
+	{
+		ctrlGroup->pendingIoTime[i + num] = ctrlGroup->pendingIoTime[i];
+		ctrlGroup->pendingIo[i + num] = ctrlGroup->pendingIo[i];
+	}
+	for(i = 0; i < num; i++)
+	{
+		ctrlGroup->pendingIoTime[i] = entry->time;
+		ctrlGroup->pendingIo[i] = entry->ioAction[i];
+	}
+	ctrlGroup->numPendingIo += num;
+	entry->numIoActions = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Add the IO actions of a queue entry sent by the IP task to the writes
+// of the cycle (written right away if the buffer is full)
+//-------------------------------------------------------------------
+void Ros_MotionServer_CollectIoActions(Incremental_data* entry, MP_IO_DATA ioWrite[], int* numIoWrite)
+{
+	int i;
+
+	for(i = 0; i < entry->numIoActions; i++)
+	{
+		if(*numIoWrite >= Q_IO_ACTION_SIZE * MP_GRP_NUM)
+			Ros_MotionServer_WriteIoActions(ioWrite, numIoWrite);
+		ioWrite[*numIoWrite] = entry->ioAction[i];
+		(*numIoWrite)++;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Write the IO actions collected during the cycle with a single call
+//-------------------------------------------------------------------
+void Ros_MotionServer_WriteIoActions(MP_IO_DATA ioWrite[], int* numIoWrite)
+{
+	int ret;
+
+	ret = mpWriteIO(ioWrite, *numIoWrite);
+	if(ret != OK)
+		printf("mpWriteIO failure (%d) writing %d trajectory IO actions\r\n", ret, *numIoWrite);
+	*numIoWrite = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Start a ramp of the trajectory time scale toward speedScale.
+// The ramp follows a smoothstep profile so that the velocity and the
+// acceleration stay continuous.
+//-------------------------------------------------------------------
+void Ros_MotionServer_SetSpeedScale(Controller* controller, float speedScale, int rampTime_ms)
+{
+	int rampCycles = rampTime_ms / controller->interpolPeriod;
+
+	// Freeze the current ramp while it is being modified (IP task has higher priority)
+	controller->speedScaleRamp = 1.0f;
+
+	if(rampCycles < 1)
+	{
+		controller->speedScale = speedScale;
+		controller->speedScaleStart = speedScale;
+		controller->speedScaleTarget = speedScale;
+		return;
+	}
+
+	controller->speedScaleStart = controller->speedScale;
+	controller->speedScaleTarget = speedScale;
+	controller->speedScaleRampStep = 1.0f / rampCycles;
+	controller->speedScaleRamp = 0.0f;
+}
+
+
+//-------------------------------------------------------------------
+// Advance the ramp of the trajectory time scale by one interpolation period
+// (IP task)
+//-------------------------------------------------------------------
+void Ros_MotionServer_UpdateSpeedScale(Controller* controller)
+{
+	float u;
+
+	if(controller->speedScaleRamp < 1.0f)
+	{
+		u = min(1.0f, controller->speedScaleRamp + controller->speedScaleRampStep);
+		controller->speedScale = controller->speedScaleStart 
+			+ (controller->speedScaleTarget - controller->speedScaleStart) * u * u * (3.0f - 2.0f * u);
+		controller->speedScaleRamp = u;
+	}
+}
+
+
+//-------------------------------------------------------------------
+// Underrun ride-through (IP task).  When the motion queued for a moving
+// trajectory gets shorter than what a ramp to a standstill consumes
+// (half the ramp time) plus a margin, the trajectory is slowed down along
+// its path.  It ramps back to nominal speed once a full ramp time is
+// buffered again or the trajectory ends at rest.
+//-------------------------------------------------------------------
+void Ros_MotionServer_RideThrough(Controller* controller)
+{
+	CtrlGroup* ctrlGroup;
+	BOOL bStarving = FALSE;
+	BOOL bRefilled = TRUE;
+	BOOL bMoving;
+	int rampTime_ms, queueTime;
+	int groupNo, axis;
+
+	if(!controller->bRideThrough)
+		return;
+
+	// Motion paused by the client
+	if(Ros_MotionServer_IsPaused(controller))
+		return;
+
+	rampTime_ms = Ros_MotionServer_GetSpeedRampTime(controller);
+
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		ctrlGroup = controller->ctrlGroups[groupNo];
+
+		// Only trajectories expecting more points can run out of motion
+		bMoving = FALSE;
+		for(axis=0; axis<ctrlGroup->numAxes; axis++)
+		{
+			if((ctrlGroup->jointMotionData.vel[axis] > 0.0f) || (ctrlGroup->jointMotionData.vel[axis] < 0.0f))
+				bMoving = TRUE;
+		}
+		if(!ctrlGroup->hasDataToProcess && (!bMoving || ctrlGroup->bTrajEndReceived))
+			continue;
+
+		queueTime = Ros_MotionServer_ReadQueueTime(controller, groupNo, NO_WAIT, NULL, NULL);
+		if(queueTime < 0)
+			continue;
+
+		if(queueTime < (rampTime_ms / 2) + controller->rideThroughMargin_ms)
+			bStarving = TRUE;
+		if(queueTime < rampTime_ms + controller->rideThroughMargin_ms)
+			bRefilled = FALSE;
+	}
+
+	if(!controller->bRideThroughActive && bStarving)
+	{
+		controller->bRideThroughActive = TRUE;
+		Ros_MotionServer_SetSpeedScale(controller, 0.0f, rampTime_ms);
+	}
+	else if(controller->bRideThroughActive && bRefilled)
+	{
+		controller->bRideThroughActive = FALSE;
+		Ros_MotionServer_SetSpeedScale(controller, 1.0f, rampTime_ms);
 	}
 }
 
 
+//-------------------------------------------------------------------
+// Time (ms) to ramp between the nominal speed of the queued trajectory and
+// a standstill.  Proportional to the fastest axis relative to its maximum
+// speed, so that the deceleration never exceeds the one of a ramp of
+// MOTION_PAUSE_RAMP_TIME from maximum joint speed.
+//-------------------------------------------------------------------
+int Ros_MotionServer_GetSpeedRampTime(Controller* controller)
+{
+	CtrlGroup* ctrlGroup;
+	Incremental_q* q;
+	Incremental_data* head;
+	float speedRatio = 0.0f;
+	float duration;
+	LONG absInc;
+	int groupNo;
+	int axis;
+
+	for(groupNo=0; groupNo<controller->numGroup; groupNo++)
+	{
+		ctrlGroup = controller->ctrlGroups[groupNo];
+		q = &ctrlGroup->inc_q;
+
+		if(mpSemTake(q->q_lock, (Q_LOCK_TIMEOUT / mpGetRtc())) == OK)
+		{
+			if(q->cnt > 0)
+			{
+				head = &q->data[q->idx];
+				duration = max((float)controller->interpolPeriod, (float)(head->time - ctrlGroup->q_time));
+				for(axis=0; axis<MP_GRP_AXES_NUM; axis++)
+				{
+					absInc = (head->inc[axis] < 0) ? -head->inc[axis] : head->inc[axis];
+					if(ctrlGroup->maxInc.maxIncrement[axis] > 0)
+						speedRatio = max(speedRatio, (absInc * controller->interpolPeriod) / (duration * ctrlGroup->maxInc.maxIncrement[axis]));
+				}
+			}
+			mpSemGive(q->q_lock);
+		}
+	}
+
+	return max((int)(min(1.0f, speedRatio) * MOTION_PAUSE_RAMP_TIME), 2 * controller->interpolPeriod);
+}
+
 
 //-----------------------------------------------------------------------
 // Convert a JointTrajData message to a JointMotionData of a control group
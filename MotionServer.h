@@ -36,12 +36,26 @@
 #include "Controller.h"
 
 #define MOTION_STOP_TIMEOUT 20
+#define MOTION_PAUSE_RAMP_TIME 500  // in milliseconds, time to ramp between maximum joint speed and standstill
+#define MOTION_MAX_RAMP_TIME 10000  // in milliseconds, longest ramp time accepted by ROS_CMD_PAUSE_MOTION / ROS_CMD_RESUME_MOTION
+#define RIDE_THROUGH_MARGIN 20  // in milliseconds, default motion time left in the queue when a ride-through deceleration ends
 #define MOTION_START_TIMEOUT 5000  // in milliseconds
 #define MOTION_START_CHECK_PERIOD 50  // in millisecond
+#define MOTION_START_THRESHOLD 0  // in milliseconds, default motion time buffered before a trajectory starts
 #define MOTION_INIT_ROS_JOB "INIT_ROS"
 
-extern void Ros_MotionServer_StartNewConnection(Controller* controller, int sd);
+#define LAG_CYCLE_THRESHOLD 2  // in milliseconds, default delay or execution time above which an IP cycle is late
+#define LAG_QUEUE_THRESHOLD 20  // in milliseconds, default buffered motion time below which a group with a pending point is lagging
+#define LAG_SIGNAL_HOLD_TIME 1000  // in milliseconds, time IO_FEEDBACK_REALTIME_LAG stays ON after the last lag event
+
+#define TRACE_BUFFER_SIZE 1000  // number of IP cycles kept in the trace
+
+extern void Ros_MotionServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr);
+extern BOOL Ros_MotionServer_StartIncMoveTask(Controller* controller);
 extern BOOL Ros_MotionServer_HasDataInQueue(Controller* controller);
 extern BOOL Ros_MotionServer_ClearQ_All(Controller* controller);
+extern int Ros_MotionServer_GetQueueTime(Controller* controller, int groupNo, int* queueFree, int* pendingTime);
+extern void Ros_MotionServer_ResetLagStats(Controller* controller);
+extern void Ros_MotionServer_TraceInit(Controller* controller);
 
 #endif
@@ -55,8 +55,43 @@
 int Ros_SimpleMsg_JointFeedback(CtrlGroup* ctrlGroup, SimpleMsg* sendMsg)
 {
 	int bRet;
-	long pulsePos[MAX_PULSE_AXES];
+	FeedbackSample sample;
 	
+	bRet = Ros_CtrlGroup_ReadFeedback(ctrlGroup, &sample);
+	if(bRet!=TRUE)
+		return 0;
+
+	return Ros_SimpleMsg_JointFeedbackSample(ctrlGroup, &sample, sendMsg);
+}
+
+// Creates a simple message of type: ROS_MSG_JOINT_FEEDBACK = 15
+// from a feedback sample (position and servo velocity)
+int Ros_SimpleMsg_JointFeedbackSample(CtrlGroup* ctrlGroup, FeedbackSample* sample, SimpleMsg* sendMsg)
+{
+	int msgSize;
+
+	if(!sample->bPosValid)
+		return 0;
+
+	msgSize = Ros_SimpleMsg_JointFeedbackPulse(ctrlGroup, sample->pulsePos, sendMsg);
+
+	// Full controller time (sec, usec) doesn't fit a float: sent modulo ROS_FEEDBACK_TIME_WRAP
+	sendMsg->body.jointFeedback.time = (float)(sample->time.sec % ROS_FEEDBACK_TIME_WRAP) + (float)sample->time.usec * 0.000001f;
+	sendMsg->body.jointFeedback.validFields |= 1;
+
+	if(sample->bSpeedValid)
+	{
+		Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, sample->pulseSpeed, sendMsg->body.jointFeedback.vel);
+		sendMsg->body.jointFeedback.validFields |= 4;
+	}
+
+	return msgSize;
+}
+
+// Creates a simple message of type: ROS_MSG_JOINT_FEEDBACK = 15
+// from a feedback pulse position already read (feedback snapshot)
+int Ros_SimpleMsg_JointFeedbackPulse(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES], SimpleMsg* sendMsg)
+{
 	//initialize memory
 	memset(sendMsg, 0x00, sizeof(SimpleMsg));
 	
@@ -71,10 +106,6 @@ int Ros_SimpleMsg_JointFeedback(CtrlGroup* ctrlGroup, SimpleMsg* sendMsg)
 	// set body
 	sendMsg->body.jointFeedback.groupNo = ctrlGroup->groupNo;
 	sendMsg->body.jointFeedback.validFields = 2;
-	
-	bRet = Ros_CtrlGroup_GetFBPulsePos(ctrlGroup, pulsePos);
-	if(bRet!=TRUE)
-		return 0;
 				
 	Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, pulsePos, sendMsg->body.jointFeedback.pos);
 
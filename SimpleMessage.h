@@ -33,10 +33,30 @@
 #define SIMPLE_MSG_H
 
 //#include "motoPlus.h"
+
+// Controller time (Ros_Controller_GetTime): time elapsed since the controller started
+// (defined before CtrlGroup.h, which uses it for the feedback samples)
+typedef struct
+{
+	UINT32 sec;
+	UINT32 usec;
+} RosTime;
+
 #include "CtrlGroup.h"
 
 #define ROS_MAX_JOINT 10
 #define MOT_MAX_GR     4
+#define ROS_MAX_TRACE_DATA 512
+#define ROS_MAX_TRAJ_IO_ACTIONS 4	// Maximum number of IO actions carried by a trajectory point
+#define ROS_MAX_IO_LIST 128		// Maximum number of addresses in an IO list read message
+#define ROS_MAX_IO_WRITE_LIST 64	// Maximum number of entries in an IO list write message (keeps SimpleMsg size)
+#define ROS_MAX_IO_GROUP_BYTES 32	// Maximum number of consecutive bytes in a wide IO group message
+#define ROS_MAX_IO_SUBSCRIBE 32	// Maximum number of addresses monitored for a state client
+#define ROS_IO_REGISTER_ADDRESS_MIN 1000000	// Addresses from this one are registers (16 bit values), bits below
+#define ROS_MAX_FEEDBACK_DELTA_DATA (MOT_MAX_GR * (3 + 3 * ROS_MAX_JOINT * sizeof(INT32)))
+#define ROS_FEEDBACK_DELTA_POS_SCALE 100000.0	// Compact position units per radian (or meter)
+#define ROS_FEEDBACK_DELTA_VEL_SCALE 10000.0	// Compact velocity units per radian/sec (or meter/sec)
+#define ROS_FEEDBACK_TIME_WRAP 64	// ROS_MSG_JOINT_FEEDBACK time wraps every 64 sec (keeps a float precise to a few microseconds)
 
 //----------------
 // Prefix Section
@@ -71,6 +91,28 @@ typedef enum
 	ROS_MSG_MOTO_JOINT_TRAJ_PT_FULL_EX = 2016,
 	ROS_MSG_MOTO_JOINT_FEEDBACK_EX = 2017,
     ROS_MSG_GET_VERSION_REPLY = 2018,
+	ROS_MSG_MOTO_GET_DIAGNOSTICS = 2019,
+	ROS_MSG_MOTO_GET_DIAGNOSTICS_REPLY = 2020,
+	ROS_MSG_MOTO_STATE_SUBSCRIBE = 2021,
+	ROS_MSG_MOTO_STATE_FRAME = 2022,
+	ROS_MSG_MOTO_UDP_SUBSCRIBE = 2023,
+	ROS_MSG_MOTO_UDP_FEEDBACK = 2024,
+	ROS_MSG_MOTO_TRACE_READ = 2025,
+	ROS_MSG_MOTO_TRACE_DATA = 2026,
+	ROS_MSG_MOTO_JOINT_FEEDBACK_DELTA = 2027,
+	ROS_MSG_MOTO_CLOCK_SYNC = 2028,
+	ROS_MSG_MOTO_STATUS_EVENT = 2029,
+	ROS_MSG_MOTO_READ_IO_LIST = 2030,
+	ROS_MSG_MOTO_READ_IO_LIST_REPLY = 2031,
+	ROS_MSG_MOTO_WRITE_IO_LIST = 2032,
+	ROS_MSG_MOTO_WRITE_IO_LIST_REPLY = 2033,
+	ROS_MSG_MOTO_IO_SUBSCRIBE = 2034,
+	ROS_MSG_MOTO_IO_CHANGE = 2035,
+	ROS_MSG_MOTO_READ_IO_GROUPS = 2036,
+	ROS_MSG_MOTO_READ_IO_GROUPS_REPLY = 2037,
+	ROS_MSG_MOTO_WRITE_IO_GROUPS = 2038,
+	ROS_MSG_MOTO_WRITE_IO_GROUPS_REPLY = 2039,
+	ROS_MSG_MOTO_MOTION_REPLY_EX = 2040,
 } SmMsgType;
 
 
@@ -99,8 +141,19 @@ typedef enum
 	ROS_CMD_START_SERVOS = 200112, // starts the servo motors
 	ROS_CMD_STOP_SERVOS = 200113, // stops the servo motors and motion
 	ROS_CMD_RESET_ALARM = 200114, // clears the error in the current controller
+	ROS_CMD_PAUSE_MOTION = 200115, // decelerates to a standstill keeping the queued trajectory (data[0]: optional ramp time in sec)
+	ROS_CMD_RESUME_MOTION = 200116, // re-accelerates and continues a paused trajectory (data[0]: optional ramp time in sec)
+	ROS_CMD_SPLICE_TRAJ = 200117, // drops the trajectory after data[0] (time in sec); reply subcode is the splice time (ms), data/data2 the pos/vel at that time.
+								  // The trajectory continues with the next points of the current sequence (sequence > 0).
+	ROS_CMD_SET_LAG_THRESHOLDS = 200118, // data[0]: IP cycle threshold, data[1]: buffered motion threshold (sec, 0 = disabled, <0 = unchanged)
+	ROS_CMD_SET_START_THRESHOLD = 200119, // data[0]: motion time buffered before a trajectory starts (sec, 0 = start immediately). Valid for the connection.
+	ROS_CMD_SET_RIDE_THROUGH = 200120, // data[0]: 1 = slow down when the queued motion runs out, 0 = disabled; data[1]: optional margin (sec). Valid for the connection.
 	ROS_CMD_START_TRAJ_MODE = 200121,
 	ROS_CMD_STOP_TRAJ_MODE = 200122,
+	ROS_CMD_TRACE_START = 200123, // clears the trace and records every IP cycle (the oldest cycles are overwritten)
+	ROS_CMD_TRACE_STOP = 200124, // stops recording the trace
+	ROS_CMD_TRACE_TRIGGER = 200125, // stops recording after data[0] more seconds (default: half the trace); reply subcode is the number of cycles
+	ROS_CMD_SET_MOTION_REPLY_EX = 200126, // data[0]: 1 = reply with ROS_MSG_MOTO_MOTION_REPLY_EX (queue state), 0 = ROS_MSG_MOTO_MOTION_REPLY. Valid for the connection.
 	ROS_CMD_DISCONNECT = 200130
 } SmCommandType;
 
@@ -153,7 +206,8 @@ typedef enum
 	ROS_RESULT_NOT_READY_HOLD,
 	ROS_RESULT_NOT_READY_NOT_STARTED,
 	ROS_RESULT_NOT_READY_WAITING_ROS,
-	ROS_RESULT_NOT_READY_SKILLSEND
+	ROS_RESULT_NOT_READY_SKILLSEND,
+	ROS_RESULT_NOT_READY_PAUSED	// a new trajectory isn't started while the motion is paused (ROS_CMD_RESUME_MOTION first)
 } SmNotReadySubcode;
 
 
@@ -187,24 +241,37 @@ struct _SmBodyRobotStatus		// ROS_MSG_ROBOT_STATUS = 13
 } __attribute__((__packed__));
 typedef struct _SmBodyRobotStatus SmBodyRobotStatus;
 
+struct _SmTrajIOAction
+{
+	UINT32 ioAddress;
+	UINT32 ioValue;
+	int timeOffset;				// Time (ms) relative to the point time at which the value is written (negative = before reaching the point)
+} __attribute__((__packed__));
+typedef struct _SmTrajIOAction SmTrajIOAction;
+
 struct _SmBodyJointTrajPtFull	// ROS_MSG_JOINT_TRAJ_PT_FULL = 14
 {
 	int groupNo;  				// Robot/group ID;  0 = 1st robot 
 	int sequence;				// Index of point in trajectory; 0 = Initial trajectory point, which should match the robot current position.
-	int validFields;			// Bit-mask indicating which ?optional? fields are filled with data. 1=time, 2=position, 4=velocity, 8=acceleration, 16=ioReadAddress
+	int validFields;			// Bit-mask indicating which ?optional? fields are filled with data. 1=time, 2=position, 4=velocity, 8=acceleration, 16=ioReadAddress, 32=last point of the trajectory, 64=ioActions, 128=ioReadAddress may be read from the IO cache (value up to one interpolation period old)
 	float time;					// Timestamp associated with this trajectory point; Units: in seconds 
 	float pos[ROS_MAX_JOINT];	// Desired joint positions in radian.  Base to Tool joint order  
 	float vel[ROS_MAX_JOINT];	// Desired joint velocities in radian/sec.  
 	float acc[ROS_MAX_JOINT];	// Desired joint accelerations in radian/sec^2.
 	UINT32 ioReadAddress;       // If validFields&16 is set, then read from this IO and write back to the reply.
+	UINT32 numIoActions;		// Only sent if validFields&64 is set, followed by numIoActions entries
+	SmTrajIOAction ioAction[ROS_MAX_TRAJ_IO_ACTIONS];	// Written by the IP task in the interpolation cycle the trajectory reaches the point time + timeOffset
 } __attribute__((__packed__));
 typedef struct _SmBodyJointTrajPtFull SmBodyJointTrajPtFull;
 
+// Size of a ROS_MSG_JOINT_TRAJ_PT_FULL body without IO actions
+#define ROS_JOINT_TRAJ_PT_FULL_SIZE (sizeof(SmBodyJointTrajPtFull) - sizeof(UINT32) - (sizeof(SmTrajIOAction) * ROS_MAX_TRAJ_IO_ACTIONS))
+
 struct _SmBodyJointFeedback		// ROS_MSG_JOINT_FEEDBACK = 15
 {
 	int groupNo;  				// Robot/group ID;  0 = 1st robot 
 	int validFields;			// Bit-mask indicating which ?optional? fields are filled with data. 1=time, 2=position, 4=velocity, 8=acceleration
-	float time;					// Timestamp associated with this trajectory point; Units: in seconds 
+	float time;					// Timestamp associated with this trajectory point; Units: in seconds (feedback: controller time when the position was read, modulo ROS_FEEDBACK_TIME_WRAP)
 	float pos[ROS_MAX_JOINT];	// Desired joint positions in radian.  Base to Tool joint order  
 	float vel[ROS_MAX_JOINT];	// Desired joint velocities in radian/sec.  
 	float acc[ROS_MAX_JOINT];	// Desired joint accelerations in radian/sec^2.
@@ -229,17 +296,30 @@ struct _SmBodyMotoMotionReply	// ROS_MSG_MOTO_MOTION_REPLY = 2012
 	int command;				// Reference to the received message command or type
 	SmResultType result;		// High level result code
 	int subcode;				// More detailed result code (optional)
-	int powerOnTimeStamp;      // time stamp returned from mpGetSysTimes(MP_POWER_ON_TIME_ID)
+	UINT32 powerOnTimeStamp;   // controller time (ms, Ros_Controller_GetTime) when data was read, wraps every 2^32 ms
 	UINT32 ioValue;             // the read io value if it was requested by SmBodyJointTrajPtFull
 	float data[ROS_MAX_JOINT];	// Reply data - the motoros values last read from the encoders of the robot (radians)
     float data2[ROS_MAX_JOINT];	// Reply data - the motoros torque values last read from the encoders of the robot (Nm)
 } __attribute__((__packed__)); 
 typedef struct _SmBodyMotoMotionReply	SmBodyMotoMotionReply;
 
+// Sent instead of ROS_MSG_MOTO_MOTION_REPLY once the client requested it with ROS_CMD_SET_MOTION_REPLY_EX
+struct _SmBodyMotoMotionReplyEx	// ROS_MSG_MOTO_MOTION_REPLY_EX = 2040
+{
+	SmBodyMotoMotionReply reply;	// Same as ROS_MSG_MOTO_MOTION_REPLY
+	int queueTime[MOT_MAX_GR];	// Motion time (ms) buffered for each group (incremental queue + point being processed)
+	int queueFree[MOT_MAX_GR];	// Number of free entries (interpolation cycles) in the incremental queue of each group
+	int retryDelay;				// Suggested delay (ms) before the next trajectory point can be accepted (0 = now)
+	float data3[ROS_MAX_JOINT];	// Reply data - the servo velocity feedback of the robot (radians/s)
+	int motionPaused;			// 1 = paused by ROS_CMD_PAUSE_MOTION (until ROS_CMD_RESUME_MOTION)
+	float speedScale;			// Trajectory time elapsed per interpolation period (0.0 = standstill, 1.0 = nominal speed)
+} __attribute__((__packed__)); 
+typedef struct _SmBodyMotoMotionReplyEx	SmBodyMotoMotionReplyEx;
+
 struct _SmBodyJointTrajPtExData
 {
 	int groupNo;  				// Robot/group ID;  0 = 1st robot 
-	int validFields;			// Bit-mask indicating which ?optional? fields are filled with data. 1=time, 2=position, 4=velocity, 8=acceleration
+	int validFields;			// Bit-mask indicating which ?optional? fields are filled with data. 1=time, 2=position, 4=velocity, 8=acceleration, 32=last point of the trajectory
 	float time;					// Timestamp associated with this trajectory point; Units: in seconds 
 	float pos[ROS_MAX_JOINT];	// Desired joint positions in radian.  Base to Tool joint order  
 	float vel[ROS_MAX_JOINT];	// Desired joint velocities in radian/sec.  
@@ -263,6 +343,174 @@ struct _SmBodyJointFeedbackEx
 } __attribute__((__packed__));
 typedef struct _SmBodyJointFeedbackEx SmBodyJointFeedbackEx;
 
+struct _SmBodyMotoGetDiagnostics	// ROS_MSG_MOTO_GET_DIAGNOSTICS = 2019
+{
+	int resetStats;				// 1 = reset the statistics after reading them
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoGetDiagnostics SmBodyMotoGetDiagnostics;
+
+struct _SmBodyMotoDiagnosticsReply	// ROS_MSG_MOTO_GET_DIAGNOSTICS_REPLY = 2020
+{
+	int interpolPeriod;			// Interpolation period of the controller (ms)
+	int lagCycleThreshold;		// Delay or execution time above which an IP cycle is late (ms, 0 = disabled)
+	int lagQueueThreshold;		// Buffered motion time below which a group with a pending point is lagging (ms, 0 = disabled)
+	UINT32 ipCycleCnt;			// Number of cycles executed by the IP task
+	UINT32 ipLateCycleCnt;		// Number of IP cycles that started late or took too long to execute
+	int ipMaxCycleInterval;		// Longest time between the start of two IP cycles (us)
+	int ipMaxExecTime;			// Longest execution time of an IP cycle (us)
+	UINT32 producerLagCnt;		// Number of IP cycles where the interpolation of a pending point didn't keep up
+	int producerMinQueueTime;	// Shortest buffered motion time while a point was pending (ms, -1 = none)
+	int lagSignal;				// State of IO_FEEDBACK_REALTIME_LAG: 1=ON, 0=OFF
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoDiagnosticsReply SmBodyMotoDiagnosticsReply;
+
+typedef enum
+{
+	ROS_STATE_FORMAT_STANDARD = 0,	// ROS_MSG_JOINT_FEEDBACK per group, ROS_MSG_MOTO_JOINT_FEEDBACK_EX and ROS_MSG_ROBOT_STATUS
+	ROS_STATE_FORMAT_FRAME = 1,		// single ROS_MSG_MOTO_STATE_FRAME
+	ROS_STATE_FORMAT_DELTA = 2,		// ROS_MSG_MOTO_JOINT_FEEDBACK_DELTA, ROS_MSG_ROBOT_STATUS when it changes and with each keyframe
+} SmStateFormat;
+
+typedef enum
+{
+	ROS_STATE_FIELD_POSITION = 0x01,
+	ROS_STATE_FIELD_VELOCITY = 0x02,
+	ROS_STATE_FIELD_TORQUE = 0x04,		// ROS_STATE_FORMAT_FRAME only
+	ROS_STATE_FIELD_COMMAND = 0x08,		// Command position (ROS_STATE_FORMAT_FRAME and ROS_STATE_FORMAT_DELTA)
+	ROS_STATE_FIELD_STATUS = 0x10,		// ROS_MSG_ROBOT_STATUS (always part of ROS_MSG_MOTO_STATE_FRAME)
+	ROS_STATE_FIELD_ALL = 0x1F,			// Default subscription
+	ROS_STATE_FIELD_EVENTS = 0x20,		// ROS_MSG_MOTO_STATUS_EVENT pushed when a status signal changes (not part of ROS_STATE_FIELD_ALL)
+} SmStateField;
+
+struct _SmBodyMotoStateSubscribe	// ROS_MSG_MOTO_STATE_SUBSCRIBE = 2021 (sent to TCP_PORT_STATE)
+{
+	int decimation;				// Publish the state every N interpolation cycles, sampled on the interpolation clock (0 = every STATE_UPDATE_MIN_PERIOD ms)
+	int format;					// Messages used to publish the state: SmStateFormat (optional, default ROS_STATE_FORMAT_STANDARD)
+	int groupMask;				// Groups published: bit N = group N (optional, 0 = all groups)
+	int fieldMask;				// Fields published: SmStateField bits (optional, 0 = all fields)
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoStateSubscribe SmBodyMotoStateSubscribe;
+
+struct _SmBodyMotoStateFrameGroup
+{
+	int groupNo;				// Robot/group ID;  0 = 1st robot 
+	int validFields;			// Bit-mask indicating which fields are filled with data. 2=position, 4=velocity, 16=torque, 32=command position
+	float pos[ROS_MAX_JOINT];	// Feedback joint positions in radian.  Base to Tool joint order
+	float vel[ROS_MAX_JOINT];	// Feedback joint velocities in radian/sec.
+	float torque[ROS_MAX_JOINT];	// Feedback joint torques (Nm)
+	float cmdPos[ROS_MAX_JOINT];	// Command joint positions in radian.
+	int queueTime;				// Motion time (ms) buffered (incremental queue + point being processed)
+	int queueFree;				// Number of free entries (interpolation cycles) in the incremental queue
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoStateFrameGroup SmBodyMotoStateFrameGroup;
+
+struct _SmBodyMotoStateFrame	// ROS_MSG_MOTO_STATE_FRAME = 2022
+{
+	UINT32 cycle;				// Snapshot cycle of the feedback (0 when not sampled on the interpolation clock)
+	RosTime time;				// Controller time when the feedback was read
+	SmBodyRobotStatus status;	// Controller/robot status (same as ROS_MSG_ROBOT_STATUS)
+	int numberOfValidGroups;
+	SmBodyMotoStateFrameGroup groups[MOT_MAX_GR];	// Subscribed groups.  Only numberOfValidGroups are sent
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoStateFrame SmBodyMotoStateFrame;
+
+struct _SmBodyMotoUdpSubscribe	// ROS_MSG_MOTO_UDP_SUBSCRIBE = 2023 (datagram sent to UDP_PORT_STATE by a host with an open state or motion connection)
+{
+	int subscribe;				// 1 = register (or keep alive) the sender endpoint, 0 = unregister
+	int decimation;				// Publish every N interpolation cycles (0 = every STATE_UPDATE_MIN_PERIOD ms)
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoUdpSubscribe SmBodyMotoUdpSubscribe;
+
+struct _SmBodyMotoUdpFeedback	// ROS_MSG_MOTO_UDP_FEEDBACK = 2024 (datagram sent from UDP_PORT_STATE)
+{
+	UINT32 sequence;			// Incremented for each datagram sent to the client (a gap is a lost sample)
+	UINT32 cycle;				// Snapshot cycle of the feedback (0 when not sampled on the interpolation clock)
+	RosTime time;				// Controller time when the feedback was read
+	int numberOfValidGroups;
+	SmBodyJointFeedback feedback[MOT_MAX_GR];	// Only numberOfValidGroups are sent
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoUdpFeedback SmBodyMotoUdpFeedback;
+
+// Compact feedback: for each valid group, data holds
+//   UINT8 groupNo, UINT8 validFields (2=position, 4=velocity, 32=command position), UINT8 jointMask (bit N = joint N, Base to Tool joint order)
+//   followed by the position, the velocity then the command position of each joint in jointMask (only the fields in validFields):
+//   keyframe: INT32 value, otherwise: INT16 difference with the value of the previous message.
+// Values are in 1/ROS_FEEDBACK_DELTA_POS_SCALE rad (or m) and 1/ROS_FEEDBACK_DELTA_VEL_SCALE rad/sec (or m/sec).
+// Only the subscribed groups are sent.
+struct _SmBodyMotoJointFeedbackDelta	// ROS_MSG_MOTO_JOINT_FEEDBACK_DELTA = 2027
+{
+	UINT32 sequence;			// Incremented for each message sent to the client (after a gap, ignore the messages until the next keyframe)
+	UINT32 cycle;				// Snapshot cycle of the feedback (0 when not sampled on the interpolation clock)
+	RosTime time;				// Controller time when the feedback was read
+	UINT8 keyframe;				// 1 = absolute values, 0 = differences with the previous message
+	UINT8 numberOfValidGroups;
+	UINT16 size;				// Number of bytes in data
+	UINT8 data[ROS_MAX_FEEDBACK_DELTA_DATA];	// Only size bytes are sent
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoJointFeedbackDelta SmBodyMotoJointFeedbackDelta;
+
+struct _SmBodyMotoStatusEvent	// ROS_MSG_MOTO_STATUS_EVENT = 2029 (pushed to the state clients subscribed to ROS_STATE_FIELD_EVENTS)
+{
+	UINT32 sequence;			// Incremented for each event detected by the controller (a gap is a lost event)
+	RosTime time;				// Controller time when the change was detected
+	int signal;					// Status signal that changed (IoStatusIndex: 0=major alarm, 1=minor alarm, 2=system alarm, 3=user alarm, 4=error, 5=play, 6=teach, 7=remote, 8=operating, 9=hold, 10=servo on, 11=external e-stop, 12=pendant e-stop, 13=controller e-stop, 14=waiting for ROS, 15=eco mode)
+	int value;					// New state of the signal (0=OFF)
+	int alarmCode;				// Alarm code active after the change (0 = none)
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoStatusEvent SmBodyMotoStatusEvent;
+
+// Clock synchronization: with t4 the client time when the reply is received,
+//   offset (controller time - client time) = ((t2 - t1) + (t3 - t4)) / 2
+//   round trip delay = (t4 - t1) - (t3 - t2)
+struct _SmBodyMotoClockSync		// ROS_MSG_MOTO_CLOCK_SYNC = 2028 (request and reply, motion port or datagram to UDP_PORT_STATE)
+{
+	RosTime clientTime;			// t1: Client time when the request was sent (returned unchanged)
+	RosTime receiveTime;		// t2: Controller time when the request was received (reply)
+	RosTime transmitTime;		// t3: Controller time when the reply was sent (reply)
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoClockSync SmBodyMotoClockSync;
+
+typedef enum
+{
+	ROS_TRACE_STOPPED = 0,
+	ROS_TRACE_RECORDING = 1,
+	ROS_TRACE_TRIGGERED = 2,	// recording the cycles that follow the trigger
+} SmTraceState;
+
+struct _SmMotoTraceEntry		// IP cycle recorded in the trace, followed by one SmMotoTraceGroup per group
+{
+	UINT32 tick;				// System tick at the start of the cycle
+	UINT32 cycle;				// Snapshot cycle of the positions
+} __attribute__((__packed__));
+typedef struct _SmMotoTraceEntry SmMotoTraceEntry;
+
+struct _SmMotoTraceGroup
+{
+	int inc[MAX_PULSE_AXES];	// Increment sent during the cycle (pulse)
+	int cmdPos[MAX_PULSE_AXES];	// Command position at the start of the cycle (pulse)
+	int fbPos[MAX_PULSE_AXES];	// Feedback position at the start of the cycle (pulse)
+	int queueCnt;				// Number of increments left in the queue
+} __attribute__((__packed__));
+typedef struct _SmMotoTraceGroup SmMotoTraceGroup;
+
+struct _SmBodyMotoTraceRead		// ROS_MSG_MOTO_TRACE_READ = 2025
+{
+	int offset;					// Byte offset in the trace of the data to read (0 = oldest entry)
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoTraceRead SmBodyMotoTraceRead;
+
+struct _SmBodyMotoTraceData		// ROS_MSG_MOTO_TRACE_DATA = 2026
+{
+	int state;					// SmTraceState
+	int numGroup;				// Number of SmMotoTraceGroup in each entry
+	int entrySize;				// Size (bytes) of an entry
+	int numEntries;				// Number of entries recorded
+	int offset;					// Byte offset in the trace of data
+	int size;					// Number of bytes in data (0 = end of the trace)
+	UINT8 data[ROS_MAX_TRACE_DATA];	// Entries, oldest first.  Only size bytes are sent
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoTraceData SmBodyMotoTraceData;
+
 //--------------
 // IO Commands
 //--------------
@@ -270,6 +518,7 @@ typedef struct _SmBodyJointFeedbackEx SmBodyJointFeedbackEx;
 struct _SmBodyMotoReadIOBit
 {
 	UINT32 ioAddress;
+	int maxAge;					// Optional (prefix.length tells if it is sent): value read up to maxAge ms ago is accepted (IO cache), 0 = read now
 } __attribute__((__packed__));
 typedef struct _SmBodyMotoReadIOBit SmBodyMotoReadIOBit;
 
@@ -319,6 +568,100 @@ struct _SmBodyMotoWriteIOGroupReply
 } __attribute__((__packed__));
 typedef struct _SmBodyMotoWriteIOGroupReply SmBodyMotoWriteIOGroupReply;
 
+// Consecutive IO groups (bytes) read with a single request.
+// Byte i holds the bits (ioAddress + i) * 10 + 0..7, so a 32 bit value is
+// read with numBytes = 4 (least significant byte first).
+struct _SmBodyMotoReadIOGroups
+{
+	UINT32 ioAddress;						// Address of the first group
+	UINT32 numBytes;						// 1 to ROS_MAX_IO_GROUP_BYTES
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoReadIOGroups SmBodyMotoReadIOGroups;
+
+// Values of the groups (only numBytes entries are sent, 0 on failure)
+struct _SmBodyMotoReadIOGroupsReply
+{
+	UINT32 resultCode;
+	UINT32 numBytes;
+	UINT8 value[ROS_MAX_IO_GROUP_BYTES];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoReadIOGroupsReply SmBodyMotoReadIOGroupsReply;
+
+// Consecutive IO groups (bytes) written with a single request (only numBytes values are sent).
+// Replied with SmBodyMotoWriteIOGroupReply.
+struct _SmBodyMotoWriteIOGroups
+{
+	UINT32 ioAddress;						// Address of the first group
+	UINT32 numBytes;						// 1 to ROS_MAX_IO_GROUP_BYTES
+	UINT8 value[ROS_MAX_IO_GROUP_BYTES];	// Least significant byte first
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoWriteIOGroups SmBodyMotoWriteIOGroups;
+
+// Read several addresses with a single request (only numAddresses entries are sent)
+struct _SmBodyMotoReadIOList
+{
+	UINT32 numAddresses;					// 1 to ROS_MAX_IO_LIST
+	UINT32 ioAddress[ROS_MAX_IO_LIST];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoReadIOList SmBodyMotoReadIOList;
+
+// Values in the order of the request (only numValues entries are sent, 0 on failure)
+struct _SmBodyMotoReadIOListReply
+{
+	UINT32 resultCode;
+	UINT32 numValues;
+	UINT32 value[ROS_MAX_IO_LIST];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoReadIOListReply SmBodyMotoReadIOListReply;
+
+struct _SmIOListEntry
+{
+	UINT32 ioAddress;
+	UINT32 ioValue;
+} __attribute__((__packed__));
+typedef struct _SmIOListEntry SmIOListEntry;
+
+// Write several addresses with a single request (only numEntries entries are sent).
+// The list is applied as a whole: nothing is written if any entry is rejected.
+struct _SmBodyMotoWriteIOList
+{
+	UINT32 numEntries;						// 1 to ROS_MAX_IO_WRITE_LIST
+	SmIOListEntry entry[ROS_MAX_IO_WRITE_LIST];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoWriteIOList SmBodyMotoWriteIOList;
+
+// Result of each entry in the order of the request (only numResults entries are sent):
+// ROS_REPLY_SUCCESS = written, ROS_REPLY_FAILURE = entry rejected or write failed,
+// ROS_REPLY_INVALID = not written because another entry was rejected
+struct _SmBodyMotoWriteIOListReply
+{
+	UINT32 resultCode;
+	UINT32 numResults;
+	UINT32 entryResult[ROS_MAX_IO_WRITE_LIST];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoWriteIOListReply SmBodyMotoWriteIOListReply;
+
+// Request sent to the state server to monitor a set of addresses (only numAddresses entries are sent).
+// The addresses are sampled every period and the changes are pushed with ROS_MSG_MOTO_IO_CHANGE.
+struct _SmBodyMotoIOSubscribe	// ROS_MSG_MOTO_IO_SUBSCRIBE = 2034
+{
+	int period;								// Sampling period (ms), rounded up to the interpolation period (0 = stop monitoring)
+	UINT32 numAddresses;					// 1 to ROS_MAX_IO_SUBSCRIBE (0 when period is 0)
+	UINT32 ioAddress[ROS_MAX_IO_SUBSCRIBE];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoIOSubscribe SmBodyMotoIOSubscribe;
+
+// Values that changed in a sample (only numChanges entries are sent).
+// The first message after the subscription reports every address.
+struct _SmBodyMotoIOChange	// ROS_MSG_MOTO_IO_CHANGE = 2035
+{
+	UINT32 sequence;						// Incremented for each message of the subscription (a gap is a lost change)
+	RosTime time;							// Controller time of the sample
+	UINT32 numChanges;
+	SmIOListEntry change[ROS_MAX_IO_SUBSCRIBE];
+} __attribute__((__packed__));
+typedef struct _SmBodyMotoIOChange SmBodyMotoIOChange;
+
 
 //--------------
 // Body Union
@@ -327,11 +670,23 @@ typedef struct _SmBodyMotoWriteIOGroupReply SmBodyMotoWriteIOGroupReply;
 typedef union
 {
     SmBodyGetVersionReply versionReply;
+	SmBodyMotoGetDiagnostics getDiagnostics;
+	SmBodyMotoDiagnosticsReply diagnosticsReply;
+	SmBodyMotoStateSubscribe stateSubscribe;
+	SmBodyMotoStateFrame stateFrame;
+	SmBodyMotoUdpSubscribe udpSubscribe;
+	SmBodyMotoUdpFeedback udpFeedback;
+	SmBodyMotoJointFeedbackDelta jointFeedbackDelta;
+	SmBodyMotoClockSync clockSync;
+	SmBodyMotoStatusEvent statusEvent;
+	SmBodyMotoTraceRead traceRead;
+	SmBodyMotoTraceData traceData;
 	SmBodyRobotStatus robotStatus;
 	SmBodyJointTrajPtFull jointTrajData;
 	SmBodyJointFeedback	jointFeedback;
 	SmBodyMotoMotionCtrl motionCtrl;
 	SmBodyMotoMotionReply motionReply;
+	SmBodyMotoMotionReplyEx motionReplyEx;
 	SmBodyJointTrajPtFullEx jointTrajDataEx;
 	SmBodyJointFeedbackEx jointFeedbackEx;
 	SmBodyMotoReadIOBit readIOBit;
@@ -342,6 +697,15 @@ typedef union
 	SmBodyMotoReadIOGroupReply readIOGroupReply;
 	SmBodyMotoWriteIOGroup writeIOGroup;
 	SmBodyMotoWriteIOGroupReply writeIOGroupReply;
+	SmBodyMotoReadIOGroups readIOGroups;
+	SmBodyMotoReadIOGroupsReply readIOGroupsReply;
+	SmBodyMotoWriteIOGroups writeIOGroups;
+	SmBodyMotoReadIOList readIOList;
+	SmBodyMotoReadIOListReply readIOListReply;
+	SmBodyMotoWriteIOList writeIOList;
+	SmBodyMotoWriteIOListReply writeIOListReply;
+	SmBodyMotoIOSubscribe ioSubscribe;
+	SmBodyMotoIOChange ioChange;
 } SmBody;
 
 
@@ -362,6 +726,8 @@ typedef struct _SimpleMsg SimpleMsg;
 //-------------------
 
 extern int Ros_SimpleMsg_JointFeedback(CtrlGroup* ctrlGroup, SimpleMsg* sendMsg);
+extern int Ros_SimpleMsg_JointFeedbackPulse(CtrlGroup* ctrlGroup, long pulsePos[MAX_PULSE_AXES], SimpleMsg* sendMsg);
+extern int Ros_SimpleMsg_JointFeedbackSample(CtrlGroup* ctrlGroup, FeedbackSample* sample, SimpleMsg* sendMsg);
 extern void Ros_SimpleMsg_JointFeedbackEx_Init(int numberOfGroups, SimpleMsg* sendMsg);
 extern int Ros_SimpleMsg_JointFeedbackEx_Build(int groupIndex, SimpleMsg* src_msgFeedback, SimpleMsg* dst_msgExtendedFeedback);
 
@@ -35,13 +35,38 @@
 #include "SimpleMessage.h"
 #include "Controller.h"
 #include "StateServer.h"
+#include "MotionServer.h"
 
 //-----------------------
 // Function Declarations
 //-----------------------
-void Ros_StateServer_StartNewConnection(Controller* controller, int sd);
+void Ros_StateServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr);
+void Ros_StateServer_StartSendStateTask(Controller* controller);
+void Ros_StateServer_StopConnection(Controller* controller, int connectionIndex);
 void Ros_StateServer_SendState(Controller* controller);
-BOOL Ros_StateServer_SendMsgToAllClient(Controller* controller, SimpleMsg* sendMsg, int msgSize);
+BOOL Ros_StateServer_IsUpdateDue(Controller* controller, BOOL bSync, UINT32 cycle, int decimation, UINT32 lastCycle);
+BOOL Ros_StateServer_SendStandardState(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], SimpleMsg* statusMsg, int statusMsgSize);
+BOOL Ros_StateServer_QueueMsg(Controller* controller, int connectionIndex, SimpleMsg* sendMsg, int msgSize);
+BOOL Ros_StateServer_QueueReply(Controller* controller, int connectionIndex, SimpleMsg* replyMsg);
+BOOL Ros_StateServer_SendQueued(Controller* controller, int connectionIndex);
+int Ros_StateServer_GetQueueSpace(StateSendQueue* q, int msgSize);
+void Ros_StateServer_FlushClients(Controller* controller);
+void Ros_StateServer_ReceiveMsg(Controller* controller);
+int Ros_StateServer_SimpleMsgProcess(Controller* controller, int connectionIndex, SimpleMsg* receiveMsg, int byteSize, SimpleMsg* replyMsg);
+int Ros_StateServer_StateFrame(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* statusMsg, SimpleMsg* sendMsg);
+void Ros_StateServer_ReceiveUdpMsg(Controller* controller);
+void Ros_StateServer_SendUdpFeedback(Controller* controller, FeedbackSample fbSample[MP_GRP_NUM], BOOL bSync, UINT32 cycle);
+BOOL Ros_StateServer_SendFeedbackDelta(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* statusMsg, int statusMsgSize);
+int Ros_StateServer_JointFeedbackDelta(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* sendMsg);
+void Ros_StateServer_QuantizeJoints(CtrlGroup* ctrlGroup, long pulseValue[MAX_PULSE_AXES], double scale, INT32 value[ROS_MAX_JOINT]);
+BOOL Ros_StateServer_IsDeltaInRange(UCHAR jointMask, INT32 value[ROS_MAX_JOINT], INT32 ref[ROS_MAX_JOINT]);
+UINT8* Ros_StateServer_PackJoints(UINT8* data, BOOL bKeyframe, UCHAR jointMask, INT32 value[ROS_MAX_JOINT], INT32 ref[ROS_MAX_JOINT]);
+void Ros_StateServer_SendStatusEvents(Controller* controller);
+int Ros_StateServer_IOSubscribe(Controller* controller, int connectionIndex, SimpleMsg* receiveMsg, int byteSize);
+void Ros_StateServer_StopIOSubscription(Controller* controller, int connectionIndex);
+void Ros_StateServer_MonitorIO(Controller* controller);
+BOOL Ros_StateServer_SampleIO(Controller* controller, int connectionIndex);
+void Ros_StateServer_SendIOChanges(Controller* controller);
 
 //-----------------------
 // Function implementation
@@ -51,7 +76,7 @@ BOOL Ros_StateServer_SendMsgToAllClient(Controller* controller, SimpleMsg* sendM
 // Start the task for a new state server connection:
 // - Ros_StateServer_SendState: Task that broadcasts controller & robot state to the connected client
 //-----------------------------------------------------------------------
-void Ros_StateServer_StartNewConnection(Controller* controller, int sd)
+void Ros_StateServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr)
 {
 	int connectionIndex;
 
@@ -62,23 +87,29 @@ void Ros_StateServer_StartNewConnection(Controller* controller, int sd)
 	{
 		if (controller->sdStateConnections[connectionIndex] == INVALID_SOCKET)
 		{
+			// Outgoing buffer of the client (allocated before the socket is published to the send task)
+			controller->stateSendQ[connectionIndex] = mpMalloc(sizeof(StateSendQueue));
+			if(controller->stateSendQ[connectionIndex] == NULL)
+			{
+				printf("Failed to allocate the send queue of the State server connection.\r\n");
+				mpClose(sd);
+				return;
+			}
+			memset(controller->stateSendQ[connectionIndex], 0x00, sizeof(StateSendQueue));
+			controller->stateSendQ[connectionIndex]->deltaKeyframeCnt = -1;
+
 			//Start the new connection in a different task.
 			//Each task's memory will be unique IFF the data is on the stack.
 			//Any global or heap stuff will not be unique.
+			controller->stateClientAddr[connectionIndex] = clientAddr;
 			controller->sdStateConnections[connectionIndex] = sd;
+			controller->stateDecimation[connectionIndex] = 0;
+			controller->stateFormat[connectionIndex] = ROS_STATE_FORMAT_STANDARD;
+			controller->stateGroupMask[connectionIndex] = STATE_GROUP_MASK_ALL;
+			controller->stateFieldMask[connectionIndex] = ROS_STATE_FIELD_ALL;
+			controller->stateLastCycle[connectionIndex] = controller->fbSnapshotCycle;
 			
-			// If not started
-			if(controller->tidStateSendState == INVALID_TASK)
-			{
-				//start task that will send the controller state
-				controller->tidStateSendState = mpCreateTask(MP_PRI_TIME_NORMAL, MP_STACK_SIZE, 
-											(FUNCPTR)Ros_StateServer_SendState,
-											(int)controller, 0, 0, 0, 0, 0, 0, 0, 0, 0);
-				
-				//set feedback signal
-				if(controller->tidStateSendState != INVALID_TASK)
-					Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, TRUE);
-			}
+			Ros_StateServer_StartSendStateTask(controller);
 			
 			break;
 		}
@@ -92,44 +123,256 @@ void Ros_StateServer_StartNewConnection(Controller* controller, int sd)
 }
 
 
+//-----------------------------------------------------------------------
+// Start the task sending the state (TCP and UDP clients) if not running
+//-----------------------------------------------------------------------
+void Ros_StateServer_StartSendStateTask(Controller* controller)
+{
+	// The IP task samples the feedback for clock synchronous publishing
+	Ros_MotionServer_StartIncMoveTask(controller);
+	
+	// If not started
+	if(controller->tidStateSendState == INVALID_TASK)
+	{
+		//start task that will send the controller state
+		controller->tidStateSendState = mpCreateTask(MP_PRI_TIME_NORMAL, MP_STACK_SIZE, 
+									(FUNCPTR)Ros_StateServer_SendState,
+									(int)controller, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		
+		//set feedback signal
+		if(controller->tidStateSendState != INVALID_TASK)
+			Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, TRUE);
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// Close a state server connection
+//-----------------------------------------------------------------------
+void Ros_StateServer_StopConnection(Controller* controller, int connectionIndex)
+{
+	mpClose(controller->sdStateConnections[connectionIndex]);
+	if(controller->stateSendQ[connectionIndex] != NULL)
+	{
+		if(controller->stateSendQ[connectionIndex]->dropCnt > 0)
+			printf("StateServer client %d: %d messages dropped\r\n", connectionIndex, controller->stateSendQ[connectionIndex]->dropCnt);
+		mpFree(controller->stateSendQ[connectionIndex]);
+		controller->stateSendQ[connectionIndex] = NULL;
+	}
+	controller->sdStateConnections[connectionIndex] = INVALID_SOCKET;
+	Ros_StateServer_StopIOSubscription(controller, connectionIndex);
+	controller->stateDecimation[connectionIndex] = 0;
+	controller->stateFormat[connectionIndex] = ROS_STATE_FORMAT_STANDARD;
+	controller->stateGroupMask[connectionIndex] = STATE_GROUP_MASK_ALL;
+	controller->stateFieldMask[connectionIndex] = ROS_STATE_FIELD_ALL;
+}
+
+
 //-----------------------------------------------------------------------
 // Send state (robot position and controller status) as long as there is
-// an active connection
+// an active connection.
+// Clients subscribed with a decimation are published on the interpolation
+// clock from the feedback snapshot; the others every STATE_UPDATE_MIN_PERIOD.
+// The status events and IO changes posted in between are pushed right
+// away, without delaying the next periodic update.
+// Each client only receives the groups and fields it subscribed to.
 //-----------------------------------------------------------------------
 void Ros_StateServer_SendState(Controller* controller)
 {
-	int groupNo;
+	int index;
 	SimpleMsg sendMsg;
-	SimpleMsg sendMsgFEx;
-	int msgSize, fexMsgSize = 0;
-	BOOL bOkToSendExFeedback;
+	SimpleMsg statusMsg;
+	int msgSize, statusMsgSize;
 	BOOL bHasConnections;
-	BOOL bSuccesfulSend;
+	BOOL bConnected;
+	BOOL bSync;
+	FeedbackSample fbSample[MP_GRP_NUM];
+	UINT32 cycle = 0;
+	int periodTicks;
+	int waitTicks;
+	ULONG nextUpdateTick;
 	
 	printf("Starting State Server Send State task\r\n");
 	printf("Controller number of group = %d\r\n", controller->numGroup);
 	
 	bHasConnections = FALSE;
+	periodTicks = max(1, STATE_UPDATE_MIN_PERIOD / mpGetRtc());
+	nextUpdateTick = tickGet();
 
 	//Thread for state server should never terminate
 	while(TRUE)
 	{
-		Ros_SimpleMsg_JointFeedbackEx_Init(controller->numGroup, &sendMsgFEx);
-		bOkToSendExFeedback = TRUE;
+		// Process the subscription requests from the clients
+		Ros_StateServer_ReceiveMsg(controller);
+
+		// Sample on the interpolation clock if a client requested it
+		bSync = FALSE;
+		for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+		{
+			if(controller->sdStateConnections[index] != INVALID_SOCKET && controller->stateDecimation[index] > 0)
+				bSync = TRUE;
+		}
+		for(index = 0; index < MAX_UDP_STATE_CLIENTS; index++)
+		{
+			if(controller->bUdpStateClient[index] && controller->udpStateDecimation[index] > 0)
+				bSync = TRUE;
+		}
+
+		if(bSync)
+		{
+			// Wait for the next snapshot (fall back to a periodic update if the IP task doesn't run)
+			bSync = (mpSemTake(controller->semFbSnapshot, STATE_UPDATE_MIN_PERIOD / mpGetRtc()) == OK);
+		}
+		else
+		{
+			// Wait for the status and IO changes only until the periodic update is due
+			waitTicks = (int)(nextUpdateTick - tickGet());
+			if(waitTicks > 0 && mpSemTake(controller->semStatusEvent, waitTicks) == OK)
+			{
+				// Push the changes without waiting for the periodic update
+				Ros_StateServer_SendStatusEvents(controller);
+				Ros_StateServer_SendIOChanges(controller);
+				Ros_StateServer_FlushClients(controller);
+				continue;
+			}
+
+			// Next update one period after this one was due (restart from now if late by more than a period)
+			if((int)(tickGet() - nextUpdateTick) >= periodTicks)
+				nextUpdateTick = tickGet() + periodTicks;
+			else
+				nextUpdateTick += periodTicks;
+		}
+
+		// Status and IO changes go before the periodic state
+		Ros_StateServer_SendStatusEvents(controller);
+		Ros_StateServer_SendIOChanges(controller);
+
+		cycle = Ros_Controller_GetFeedbackSnapshot(controller, fbSample);
+		statusMsgSize = -1;
+		bConnected = FALSE;
+
+		// Build the messages of each client that is due
+		for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+		{
+			if(controller->sdStateConnections[index] == INVALID_SOCKET)
+				continue;
+			bConnected = TRUE;
+
+			if(!Ros_StateServer_IsUpdateDue(controller, bSync, cycle, controller->stateDecimation[index], controller->stateLastCycle[index]))
+				continue;
+			controller->stateLastCycle[index] = cycle;
+
+			// The status is shared by the clients
+			if(statusMsgSize < 0)
+				statusMsgSize = Ros_Controller_StatusToMsg(controller, &statusMsg);
+
+			switch(controller->stateFormat[index])
+			{
+			case ROS_STATE_FORMAT_FRAME:
+				// One message carrying the state of the subscribed groups
+				msgSize = Ros_StateServer_StateFrame(controller, index, fbSample, bSync ? cycle : 0, &statusMsg, &sendMsg);
+				Ros_StateServer_QueueMsg(controller, index, &sendMsg, msgSize);
+				break;
+
+			case ROS_STATE_FORMAT_DELTA:
+				// Compact feedback encoded for the client
+				Ros_StateServer_SendFeedbackDelta(controller, index, fbSample, bSync ? cycle : 0, &statusMsg, statusMsgSize);
+				break;
+
+			default:
+				Ros_StateServer_SendStandardState(controller, index, fbSample, &statusMsg, statusMsgSize);
+				break;
+			}
+		}
+
+		// Datagrams to the UDP clients
+		if(controller->sdStateUdp != INVALID_SOCKET)
+			Ros_StateServer_SendUdpFeedback(controller, fbSample, bSync, cycle);
+
+		if(bConnected != bHasConnections)
+		{
+			bHasConnections = bConnected;
+			Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, bHasConnections);
+		}
+
+		Ros_StateServer_FlushClients(controller);
+	}
+	
+	// Terminate this task
+	controller->tidStateSendState = INVALID_TASK;
+	Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, FALSE);
+	printf("State Server Send State task was terminated\r\n");
+	mpDeleteSelf;
+}
+
+
+//-----------------------------------------------------------------------
+// Check if a client must be updated: on the interpolation clock (bSync)
+// every 'decimation' snapshots or every STATE_UPDATE_MIN_PERIOD, otherwise
+// on each periodic update
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_IsUpdateDue(Controller* controller, BOOL bSync, UINT32 cycle, int decimation, UINT32 lastCycle)
+{
+	if(!bSync)
+		return TRUE;
+	else if(decimation > 0)
+		return ((cycle - lastCycle) >= (UINT32)decimation);
+	else
+		return ((cycle - lastCycle) * controller->interpolPeriod >= STATE_UPDATE_MIN_PERIOD);
+}
+
+
+//-----------------------------------------------------------------------
+// Queue the standard state messages to a client: ROS_MSG_JOINT_FEEDBACK
+// for each subscribed group, ROS_MSG_MOTO_JOINT_FEEDBACK_EX (multiple groups)
+// and ROS_MSG_ROBOT_STATUS.  Only the subscribed fields are filled.
+// return TRUE if a message was queued
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_SendStandardState(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], SimpleMsg* statusMsg, int statusMsgSize)
+{
+	SimpleMsg sendMsg;
+	SimpleMsg sendMsgFEx;
+	int groupMask = controller->stateGroupMask[connectionIndex];
+	int fieldMask = controller->stateFieldMask[connectionIndex];
+	int groupNo;
+	int numGroup = 0, exIndex = 0;
+	int msgSize, fexMsgSize = 0;
+	BOOL bOkToSendExFeedback = TRUE;
+	BOOL bSuccessfulSend = FALSE;
+	
+	if(fieldMask & (ROS_STATE_FIELD_POSITION | ROS_STATE_FIELD_VELOCITY))
+	{
+		for(groupNo=0; groupNo < controller->numGroup; groupNo++)
+		{
+			if(groupMask & (0x01 << groupNo))
+				numGroup++;
+		}
+
+		Ros_SimpleMsg_JointFeedbackEx_Init(numGroup, &sendMsgFEx);
 
-		// Send feedback position for each control group
+		// Send feedback position for each subscribed control group
 		for(groupNo=0; groupNo < controller->numGroup; groupNo++)
 		{
-			msgSize = Ros_SimpleMsg_JointFeedback(controller->ctrlGroups[groupNo], &sendMsg);
-			fexMsgSize = Ros_SimpleMsg_JointFeedbackEx_Build(groupNo, &sendMsg, &sendMsgFEx);
+			if((groupMask & (0x01 << groupNo)) == 0)
+				continue;
+
+			msgSize = Ros_SimpleMsg_JointFeedbackSample(controller->ctrlGroups[groupNo], &fbSample[groupNo], &sendMsg);
 			if(msgSize > 0)
 			{
-				bSuccesfulSend = Ros_StateServer_SendMsgToAllClient(controller, &sendMsg, msgSize);
-				if (bSuccesfulSend != bHasConnections)
+				if((fieldMask & ROS_STATE_FIELD_POSITION) == 0)
+				{
+					memset(sendMsg.body.jointFeedback.pos, 0x00, sizeof(sendMsg.body.jointFeedback.pos));
+					sendMsg.body.jointFeedback.validFields &= ~2;
+				}
+				if((fieldMask & ROS_STATE_FIELD_VELOCITY) == 0)
 				{
-					bHasConnections = bSuccesfulSend;
-					Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, bHasConnections);
+					memset(sendMsg.body.jointFeedback.vel, 0x00, sizeof(sendMsg.body.jointFeedback.vel));
+					sendMsg.body.jointFeedback.validFields &= ~4;
 				}
+
+				fexMsgSize = Ros_SimpleMsg_JointFeedbackEx_Build(exIndex++, &sendMsg, &sendMsgFEx);
+				if(Ros_StateServer_QueueMsg(controller, connectionIndex, &sendMsg, msgSize))
+					bSuccessfulSend = TRUE;
 			}
 			else
 			{
@@ -138,56 +381,1105 @@ void Ros_StateServer_SendState(Controller* controller)
 			}
 		}
 
-		if (controller->numGroup < 2) //only send the ROS_MSG_MOTO_JOINT_FEEDBACK_EX message if we have multiple control groups
+		if (numGroup < 2) //only send the ROS_MSG_MOTO_JOINT_FEEDBACK_EX message if we have multiple control groups
 			bOkToSendExFeedback = FALSE;
 
 		if (bOkToSendExFeedback) //send extended-feedback message
-			Ros_StateServer_SendMsgToAllClient(controller, &sendMsgFEx, fexMsgSize);
+			Ros_StateServer_QueueMsg(controller, connectionIndex, &sendMsgFEx, fexMsgSize);
+	}
 
-		// Send controller/robot status
-		msgSize = Ros_Controller_StatusToMsg(controller, &sendMsg);
-		if(msgSize > 0)
+	// Send controller/robot status
+	if((fieldMask & ROS_STATE_FIELD_STATUS) && statusMsgSize > 0)
+	{
+		if(Ros_StateServer_QueueMsg(controller, connectionIndex, statusMsg, statusMsgSize))
+			bSuccessfulSend = TRUE;
+	}
+
+	return bSuccessfulSend;
+}
+
+
+//-----------------------------------------------------------------------
+// Add a message to the outgoing buffer of a client.  When the buffer is
+// full, the oldest messages are dropped: a client that doesn't read fast
+// enough only receives the most recent state.
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_QueueMsg(Controller* controller, int connectionIndex, SimpleMsg* sendMsg, int msgSize)
+{
+	StateSendQueue* q = controller->stateSendQ[connectionIndex];
+	int index;
+	int offset;
+
+	if(controller->sdStateConnections[connectionIndex] == INVALID_SOCKET || q == NULL || msgSize > STATE_SEND_BUFFER_SIZE)
+		return FALSE;
+
+	if(q->cnt == 0 && q->replySize == 0)
+		q->lastSendTick = tickGet();
+
+	// Drop the oldest messages until there is room for the new one
+	while(q->cnt > 0 && ((q->cnt >= STATE_SEND_QUEUE_SIZE) || (Ros_StateServer_GetQueueSpace(q, msgSize) < 0)))
+	{
+		if(q->sentBytes > 0 && !q->bSendingReply)
 		{
-			Ros_StateServer_SendMsgToAllClient(controller, &sendMsg, msgSize);
+			// The oldest message is partly sent, drop the new one instead
+			q->dropCnt++;
+			return FALSE;
 		}
-		Ros_Sleep(STATE_UPDATE_MIN_PERIOD);
+		q->idx = Q_OFFSET_IDX(q->idx, 1, STATE_SEND_QUEUE_SIZE);
+		q->cnt--;
+		q->dropCnt++;
 	}
-	
-	// Terminate this task
-	controller->tidStateSendState = INVALID_TASK;
-	Ros_Controller_SetIOState(IO_FEEDBACK_STATESERVERCONNECTED, FALSE);
-	printf("State Server Send State task was terminated\r\n");
-	mpDeleteSelf;
+
+	offset = (q->cnt > 0) ? Ros_StateServer_GetQueueSpace(q, msgSize) : 0;
+	index = Q_OFFSET_IDX(q->idx, q->cnt, STATE_SEND_QUEUE_SIZE);
+	memcpy(&q->buffer[offset], sendMsg, msgSize);
+	q->msgOffset[index] = offset;
+	q->msgSize[index] = msgSize;
+	q->cnt++;
+
+	return TRUE;
+}
+
+
+//-----------------------------------------------------------------------
+// Set the reply to a request of the client.  It is sent before the queued
+// messages and isn't dropped: ReceiveMsg doesn't read the next request of
+// the client until it is sent.
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_QueueReply(Controller* controller, int connectionIndex, SimpleMsg* replyMsg)
+{
+	StateSendQueue* q = controller->stateSendQ[connectionIndex];
+	int msgSize = replyMsg->prefix.length + sizeof(SmPrefix);
+
+	if(controller->sdStateConnections[connectionIndex] == INVALID_SOCKET || q == NULL 
+		|| q->replySize != 0 || msgSize > STATE_REPLY_MAX_SIZE)
+		return FALSE;
+
+	if(q->cnt == 0)
+		q->lastSendTick = tickGet();
+
+	memcpy(q->reply, replyMsg, msgSize);
+	q->replySize = msgSize;
+
+	return TRUE;
 }
 
 
 //-----------------------------------------------------------------------
-// Send state message to all active connections
-// return TRUE if message was send to at least one client
+// Position in the outgoing buffer where a message of msgSize bytes can be
+// added after the messages queued (q->cnt > 0), -1 if it doesn't fit.
 //-----------------------------------------------------------------------
-BOOL Ros_StateServer_SendMsgToAllClient(Controller* controller, SimpleMsg* sendMsg, int msgSize)
+int Ros_StateServer_GetQueueSpace(StateSendQueue* q, int msgSize)
 {
+	int last = Q_OFFSET_IDX(q->idx, q->cnt - 1, STATE_SEND_QUEUE_SIZE);
+	int head = q->msgOffset[q->idx];
+	int tail = q->msgOffset[last] + q->msgSize[last];
+
+	if(tail > head)
+	{
+		// Free space at the end of the buffer, then before the oldest message
+		if(tail + msgSize <= STATE_SEND_BUFFER_SIZE)
+			return tail;
+		if(msgSize <= head)
+			return 0;
+	}
+	else if(tail + msgSize <= head)
+	{
+		// Queued messages wrapped around, free space between the newest and the oldest
+		return tail;
+	}
+
+	return -1;
+}
+
+
+//-----------------------------------------------------------------------
+// Send the next buffered message of a client without blocking (the reply
+// first).  A message the socket only partly accepts is completed by the
+// next calls before another message is started.
+// return FALSE if the connection was closed
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_SendQueued(Controller* controller, int connectionIndex)
+{
+	StateSendQueue* q = controller->stateSendQ[connectionIndex];
+	UINT8* msg;
+	int msgSize;
+	int ret;
+
+	if(q->sentBytes == 0)
+		q->bSendingReply = (q->replySize > 0);
+
+	if(q->bSendingReply)
+	{
+		msg = q->reply;
+		msgSize = q->replySize;
+	}
+	else
+	{
+		msg = &q->buffer[q->msgOffset[q->idx]];
+		msgSize = q->msgSize[q->idx];
+	}
+
+	ret = mpSend(controller->sdStateConnections[connectionIndex], (char*)(msg + q->sentBytes), msgSize - q->sentBytes, MSG_DONTWAIT);
+	if(ret == 0)
+	{
+		printf("StateServer Send failure.  Closing state server connection.\r\n");
+		Ros_StateServer_StopConnection(controller, connectionIndex);
+		return FALSE;
+	}
+	if(ret < 0)
+		return TRUE;	// Socket full, try again later (a dead client is detected by the receive or the stall timeout)
+
+	q->lastSendTick = tickGet();
+	q->sentBytes += ret;
+	if(q->sentBytes < msgSize)
+		return TRUE;
+
+	// Message completely sent
+	q->sentBytes = 0;
+	if(q->bSendingReply)
+		q->replySize = 0;
+	else
+	{
+		q->idx = Q_OFFSET_IDX(q->idx, 1, STATE_SEND_QUEUE_SIZE);
+		q->cnt--;
+	}
+
+	return TRUE;
+}
+
+
+//-----------------------------------------------------------------------
+// Send the buffered messages to the clients that can accept them without
+// blocking, so a slow client doesn't delay the others.
+// A client that doesn't accept any message for STATE_SEND_STALL_TIMEOUT
+// is disconnected.
+//-----------------------------------------------------------------------
+void Ros_StateServer_FlushClients(Controller* controller)
+{
+	struct fd_set fds;
+	struct timeval timeout;
+	StateSendQueue* q;
 	int index;
+	int sdMax;
 	int ret;
-	BOOL bSuccessfulSend = FALSE;
-	
-	// Check all active connections
+
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+
+	// Each pass sends at most one message per client
+	while(TRUE)
+	{
+		FD_ZERO(&fds);
+		sdMax = INVALID_SOCKET;
+		for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+		{
+			q = controller->stateSendQ[index];
+			if(controller->sdStateConnections[index] != INVALID_SOCKET && q != NULL && (q->cnt > 0 || q->replySize > 0))
+			{
+				FD_SET(controller->sdStateConnections[index], &fds);
+				sdMax = max(sdMax, controller->sdStateConnections[index]);
+			}
+		}
+
+		if(sdMax == INVALID_SOCKET || mpSelect(sdMax+1, NULL, &fds, NULL, &timeout) <= 0)
+			break;
+
+		for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+		{
+			q = controller->stateSendQ[index];
+			if(controller->sdStateConnections[index] == INVALID_SOCKET || q == NULL || (q->cnt == 0 && q->replySize == 0)
+				|| !FD_ISSET(controller->sdStateConnections[index], &fds))
+				continue;
+
+			Ros_StateServer_SendQueued(controller, index);
+		}
+	}
+
+	// Disconnect the clients that stopped reading
 	for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
 	{
-		if(controller->sdStateConnections[index] != INVALID_SOCKET)
+		q = controller->stateSendQ[index];
+		if(controller->sdStateConnections[index] != INVALID_SOCKET && q != NULL && (q->cnt > 0 || q->replySize > 0)
+			&& (tickGet() - q->lastSendTick) * mpGetRtc() > STATE_SEND_STALL_TIMEOUT)
 		{
-			ret = mpSend(controller->sdStateConnections[index], (char*)(sendMsg), msgSize, 0);
-			if(ret <= 0)
+			printf("StateServer client not reading.  Closing state server connection.\r\n");
+			Ros_StateServer_StopConnection(controller, index);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// Receive and process the messages sent by the clients (without blocking)
+//-----------------------------------------------------------------------
+void Ros_StateServer_ReceiveMsg(Controller* controller)
+{
+	struct fd_set fds;
+	struct timeval timeout;
+	SimpleMsg receiveMsg;
+	SimpleMsg replyMsg;
+	int index;
+	int sdMax = INVALID_SOCKET;
+	int byteSize;
+
+	// A client is only read once the reply to its previous request is sent
+	FD_ZERO(&fds);
+	for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+	{
+		if(controller->sdStateConnections[index] != INVALID_SOCKET
+			&& (controller->stateSendQ[index] == NULL || controller->stateSendQ[index]->replySize == 0))
+		{
+			FD_SET(controller->sdStateConnections[index], &fds);
+			sdMax = max(sdMax, controller->sdStateConnections[index]);
+		}
+	}
+
+	if(sdMax == INVALID_SOCKET)
+		return;
+
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	if(mpSelect(sdMax+1, &fds, NULL, NULL, &timeout) <= 0)
+		return;
+
+	for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+	{
+		if(controller->sdStateConnections[index] == INVALID_SOCKET || !FD_ISSET(controller->sdStateConnections[index], &fds))
+			continue;
+
+		memset(&receiveMsg, 0x00, sizeof(receiveMsg));
+		byteSize = mpRecv(controller->sdStateConnections[index], (char*)(&receiveMsg), sizeof(receiveMsg), 0);
+		if(byteSize <= 0)
+		{
+			printf("StateServer client disconnected.  Closing state server connection.\r\n");
+			Ros_StateServer_StopConnection(controller, index);
+			continue;
+		}
+
+		Ros_StateServer_SimpleMsgProcess(controller, index, &receiveMsg, byteSize, &replyMsg);
+		Ros_StateServer_QueueReply(controller, index, &replyMsg);
+	}
+
+	// Send the replies without waiting for the next state update
+	Ros_StateServer_FlushClients(controller);
+}
+
+
+//-----------------------------------------------------------------------
+// Checks the type of message received on the state server and processes it
+//-----------------------------------------------------------------------
+int Ros_StateServer_SimpleMsgProcess(Controller* controller, int connectionIndex, SimpleMsg* receiveMsg, 
+										int byteSize, SimpleMsg* replyMsg)
+{
+	int expectedBytes = sizeof(SmPrefix) + sizeof(SmHeader);
+	int invalidSubcode;
+	
+	switch(receiveMsg->header.msgType)
+	{
+	case ROS_MSG_MOTO_STATE_SUBSCRIBE:
+		// The format and the masks are optional (the message was received cleared)
+		if((byteSize < expectedBytes + sizeof(int)) || (byteSize > expectedBytes + sizeof(SmBodyMotoStateSubscribe)))
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_MSGSIZE, replyMsg, 0);
+			return -1;
+		}
+		if((receiveMsg->body.stateSubscribe.decimation < 0)
+			|| (receiveMsg->body.stateSubscribe.format != ROS_STATE_FORMAT_STANDARD && receiveMsg->body.stateSubscribe.format != ROS_STATE_FORMAT_FRAME
+				&& receiveMsg->body.stateSubscribe.format != ROS_STATE_FORMAT_DELTA)
+			|| (receiveMsg->body.stateSubscribe.groupMask & ~((1 << controller->numGroup) - 1))
+			|| (receiveMsg->body.stateSubscribe.fieldMask & ~(ROS_STATE_FIELD_ALL | ROS_STATE_FIELD_EVENTS)))
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA, replyMsg, 0);
+			return -1;
+		}
+		controller->stateDecimation[connectionIndex] = receiveMsg->body.stateSubscribe.decimation;
+		controller->stateFormat[connectionIndex] = receiveMsg->body.stateSubscribe.format;
+		controller->stateGroupMask[connectionIndex] = (receiveMsg->body.stateSubscribe.groupMask != 0) ? 
+			receiveMsg->body.stateSubscribe.groupMask : STATE_GROUP_MASK_ALL;
+		controller->stateFieldMask[connectionIndex] = (receiveMsg->body.stateSubscribe.fieldMask != 0) ? 
+			receiveMsg->body.stateSubscribe.fieldMask : ROS_STATE_FIELD_ALL;
+		controller->stateLastCycle[connectionIndex] = controller->fbSnapshotCycle;
+		if(controller->stateSendQ[connectionIndex] != NULL)
+			controller->stateSendQ[connectionIndex]->deltaKeyframeCnt = -1;
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, 0);
+		break;
+
+	case ROS_MSG_MOTO_IO_SUBSCRIBE:
+		invalidSubcode = Ros_StateServer_IOSubscribe(controller, connectionIndex, receiveMsg, byteSize);
+		if(invalidSubcode != 0)
+		{
+			Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, invalidSubcode, replyMsg, 0);
+			return -1;
+		}
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_SUCCESS, 0, replyMsg, 0);
+		break;
+
+	default:
+		printf("Invalid message type received by the state server: %d\n", receiveMsg->header.msgType);
+		Ros_SimpleMsg_MotionReply(receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_MSGTYPE, replyMsg, 0);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------
+// Creates a message of type: ROS_MSG_MOTO_STATE_FRAME for a client
+// Position, velocity, torque and command position (feedback snapshot) and
+// queue state of the subscribed groups with the controller status.
+// Only the subscribed groups and fields are sent.
+//-----------------------------------------------------------------------
+int Ros_StateServer_StateFrame(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* statusMsg, SimpleMsg* sendMsg)
+{
+	SmBodyMotoStateFrameGroup* frameGroup;
+	CtrlGroup* ctrlGroup;
+	float rosPos[MAX_PULSE_AXES];
+	int groupMask = controller->stateGroupMask[connectionIndex];
+	int fieldMask = controller->stateFieldMask[connectionIndex];
+	int numGroup = 0;
+	int groupNo, i;
+
+	//initialize memory
+	memset(sendMsg, 0x00, sizeof(SimpleMsg));
+
+	// set header information
+	sendMsg->header.msgType = ROS_MSG_MOTO_STATE_FRAME;
+	sendMsg->header.commType = ROS_COMM_TOPIC;
+	sendMsg->header.replyType = ROS_REPLY_INVALID;
+
+	// set body
+	sendMsg->body.stateFrame.cycle = cycle;
+	sendMsg->body.stateFrame.time = fbSample[0].time;
+	sendMsg->body.stateFrame.status = statusMsg->body.robotStatus;
+
+	for(groupNo = 0; groupNo < min(controller->numGroup, MOT_MAX_GR); groupNo++)
+	{
+		if((groupMask & (0x01 << groupNo)) == 0)
+			continue;
+
+		ctrlGroup = controller->ctrlGroups[groupNo];
+		frameGroup = &sendMsg->body.stateFrame.groups[numGroup++];
+		frameGroup->groupNo = groupNo;
+
+		if((fieldMask & ROS_STATE_FIELD_POSITION) && fbSample[groupNo].bPosValid)
+		{
+			Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, fbSample[groupNo].pulsePos, rosPos);
+			memcpy(frameGroup->pos, rosPos, sizeof(float) * min(ROS_MAX_JOINT, MAX_PULSE_AXES));
+			frameGroup->validFields |= 2;
+		}
+
+		if((fieldMask & ROS_STATE_FIELD_VELOCITY) && fbSample[groupNo].bSpeedValid)
+		{
+			Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, fbSample[groupNo].pulseSpeed, rosPos);
+			memcpy(frameGroup->vel, rosPos, sizeof(float) * min(ROS_MAX_JOINT, MAX_PULSE_AXES));
+			frameGroup->validFields |= 4;
+		}
+
+		if((fieldMask & ROS_STATE_FIELD_TORQUE) && fbSample[groupNo].bTorqueValid)
+		{
+			for(i = 0; i < min(ROS_MAX_JOINT, MAX_PULSE_AXES); i++)
+				frameGroup->torque[i] = (float)fbSample[groupNo].torque[i];
+			frameGroup->validFields |= 16;
+		}
+
+		if((fieldMask & ROS_STATE_FIELD_COMMAND) && fbSample[groupNo].bCmdPosValid)
+		{
+			Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, fbSample[groupNo].cmdPulsePos, rosPos);
+			memcpy(frameGroup->cmdPos, rosPos, sizeof(float) * min(ROS_MAX_JOINT, MAX_PULSE_AXES));
+			frameGroup->validFields |= 32;
+		}
+
+		frameGroup->queueTime = max(0, Ros_MotionServer_GetQueueTime(controller, groupNo, &frameGroup->queueFree, NULL));
+	}
+	sendMsg->body.stateFrame.numberOfValidGroups = numGroup;
+
+	// set prefix: length of message excluding the prefix (only the subscribed groups)
+	sendMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoStateFrame)
+		- (sizeof(SmBodyMotoStateFrameGroup) * (MOT_MAX_GR - numGroup));
+
+	return(sendMsg->prefix.length + sizeof(SmPrefix));
+}
+
+
+//-----------------------------------------------------------------------
+// Receive and process a registration datagram on UDP_PORT_STATE
+// (called by the connection server when the socket is readable)
+//-----------------------------------------------------------------------
+void Ros_StateServer_ReceiveUdpMsg(Controller* controller)
+{
+	SimpleMsg receiveMsg;
+	SimpleMsg replyMsg;
+	struct sockaddr_in clientAddr;
+	int sizeofAddr = sizeof(clientAddr);
+	int byteSize;
+	int index, freeIndex;
+	int expectedBytes = sizeof(SmPrefix) + sizeof(SmHeader) + sizeof(SmBodyMotoUdpSubscribe);
+	RosTime receiveTime;
+
+	memset(&receiveMsg, 0x00, sizeof(receiveMsg));
+	memset(&clientAddr, 0x00, sizeof(clientAddr));
+	byteSize = mpRecvFrom(controller->sdStateUdp, (char*)(&receiveMsg), sizeof(receiveMsg), 0, (struct sockaddr *)&clientAddr, &sizeofAddr);
+	Ros_Controller_GetTime(&receiveTime);
+	if(byteSize <= 0)
+		return;
+
+	// Ignore datagrams from hosts without a TCP connection (no replies or feedback
+	// can be directed to a spoofed source address)
+	if(!Ros_Controller_IsConnectedAddr(controller, &clientAddr))
+		return;
+
+	if(receiveMsg.header.msgType == ROS_MSG_MOTO_CLOCK_SYNC)
+	{
+		// Reply right away: the client measures the round trip
+		if(byteSize == sizeof(SmPrefix) + sizeof(SmHeader) + sizeof(SmBodyMotoClockSync))
+			Ros_Controller_ClockSyncReply(&receiveMsg, &receiveTime, &replyMsg);
+		else
+			Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_MSGSIZE, &replyMsg, 0);
+	}
+	else if(receiveMsg.header.msgType != ROS_MSG_MOTO_UDP_SUBSCRIBE)
+	{
+		printf("Invalid message type received on the UDP state port: %d\n", receiveMsg.header.msgType);
+		Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_MSGTYPE, &replyMsg, 0);
+	}
+	else if(byteSize != expectedBytes)
+		Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_MSGSIZE, &replyMsg, 0);
+	else if(receiveMsg.body.udpSubscribe.decimation < 0)
+		Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_INVALID, ROS_RESULT_INVALID_DATA, &replyMsg, 0);
+	else
+	{
+		// Look for the endpoint (or a free slot)
+		freeIndex = -1;
+		for(index = 0; index < MAX_UDP_STATE_CLIENTS; index++)
+		{
+			if(!controller->bUdpStateClient[index])
 			{
-				printf("StateServer Send failure.  Closing state server connection.\r\n");
-				mpClose(controller->sdStateConnections[index]);
-				controller->sdStateConnections[index] = INVALID_SOCKET;
+				if(freeIndex < 0)
+					freeIndex = index;
 			}
-			else
+			else if(controller->udpStateAddr[index].sin_addr.s_addr == clientAddr.sin_addr.s_addr
+				&& controller->udpStateAddr[index].sin_port == clientAddr.sin_port)
+				break;
+		}
+
+		if(!receiveMsg.body.udpSubscribe.subscribe)
+		{
+			if(index < MAX_UDP_STATE_CLIENTS)
+				controller->bUdpStateClient[index] = FALSE;
+			Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_SUCCESS, 0, &replyMsg, 0);
+		}
+		else if(index == MAX_UDP_STATE_CLIENTS && freeIndex < 0)
+		{
+			printf("Too many UDP state clients... not accepting last attempt.\r\n");
+			Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_BUSY, 0, &replyMsg, 0);
+		}
+		else
+		{
+			if(index == MAX_UDP_STATE_CLIENTS)
 			{
-				bSuccessfulSend = TRUE;
+				// New client
+				index = freeIndex;
+				controller->udpStateAddr[index] = clientAddr;
+				controller->udpStateSequence[index] = 0;
+				controller->udpStateLastCycle[index] = controller->fbSnapshotCycle;
+				printf("New UDP state client\r\n");
 			}
+			controller->udpStateDecimation[index] = receiveMsg.body.udpSubscribe.decimation;
+			controller->udpStateRegTick[index] = tickGet();
+			controller->bUdpStateClient[index] = TRUE;
+
+			Ros_StateServer_StartSendStateTask(controller);
+			Ros_SimpleMsg_MotionReply(&receiveMsg, ROS_RESULT_SUCCESS, 0, &replyMsg, 0);
 		}
 	}
-	return bSuccessfulSend;
+
+	mpSendTo(controller->sdStateUdp, (char*)(&replyMsg), replyMsg.prefix.length + sizeof(SmPrefix), 0, 
+			(struct sockaddr *)&clientAddr, sizeof(clientAddr));
+}
+
+
+//-----------------------------------------------------------------------
+// Send a ROS_MSG_MOTO_UDP_FEEDBACK datagram to the due UDP clients.
+// A datagram that can't be sent is lost: the clients only care about the
+// most recent sample and detect the gaps with the sequence number.
+//-----------------------------------------------------------------------
+void Ros_StateServer_SendUdpFeedback(Controller* controller, FeedbackSample fbSample[MP_GRP_NUM], BOOL bSync, UINT32 cycle)
+{
+	SimpleMsg sendMsg;
+	SimpleMsg fbMsg;
+	BOOL bSendTo[MAX_UDP_STATE_CLIENTS];
+	BOOL bAnyToSend = FALSE;
+	ULONG tick = tickGet();
+	int numGroup = min(controller->numGroup, MOT_MAX_GR);
+	int index, groupNo, msgSize;
+
+	// Select the clients to update
+	for(index = 0; index < MAX_UDP_STATE_CLIENTS; index++)
+	{
+		bSendTo[index] = FALSE;
+		if(!controller->bUdpStateClient[index])
+			continue;
+
+		if((tick - controller->udpStateRegTick[index]) * mpGetRtc() > UDP_STATE_CLIENT_TIMEOUT)
+		{
+			printf("UDP state client subscription expired\r\n");
+			controller->bUdpStateClient[index] = FALSE;
+			continue;
+		}
+
+		if(!Ros_Controller_IsConnectedAddr(controller, &controller->udpStateAddr[index]))
+		{
+			printf("UDP state client subscription removed (host disconnected)\r\n");
+			controller->bUdpStateClient[index] = FALSE;
+			continue;
+		}
+
+		bSendTo[index] = Ros_StateServer_IsUpdateDue(controller, bSync, cycle, controller->udpStateDecimation[index], controller->udpStateLastCycle[index]);
+		if(bSendTo[index])
+		{
+			controller->udpStateLastCycle[index] = cycle;
+			bAnyToSend = TRUE;
+		}
+	}
+
+	if(!bAnyToSend)
+		return;
+
+	//initialize memory
+	memset(&sendMsg, 0x00, sizeof(SimpleMsg));
+
+	// set prefix: length of message excluding the prefix (only the valid groups)
+	sendMsg.prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoUdpFeedback)
+		- (sizeof(SmBodyJointFeedback) * (MOT_MAX_GR - numGroup));
+
+	// set header information
+	sendMsg.header.msgType = ROS_MSG_MOTO_UDP_FEEDBACK;
+	sendMsg.header.commType = ROS_COMM_TOPIC;
+	sendMsg.header.replyType = ROS_REPLY_INVALID;
+
+	// set body
+	sendMsg.body.udpFeedback.cycle = bSync ? cycle : 0;
+	sendMsg.body.udpFeedback.time = fbSample[0].time;
+	sendMsg.body.udpFeedback.numberOfValidGroups = numGroup;
+	for(groupNo = 0; groupNo < numGroup; groupNo++)
+	{
+		msgSize = Ros_SimpleMsg_JointFeedbackSample(controller->ctrlGroups[groupNo], &fbSample[groupNo], &fbMsg);
+		if(msgSize > 0)
+			sendMsg.body.udpFeedback.feedback[groupNo] = fbMsg.body.jointFeedback;
+		else
+			sendMsg.body.udpFeedback.feedback[groupNo].groupNo = groupNo;
+	}
+
+	for(index = 0; index < MAX_UDP_STATE_CLIENTS; index++)
+	{
+		if(!bSendTo[index])
+			continue;
+
+		sendMsg.body.udpFeedback.sequence = ++controller->udpStateSequence[index];
+		mpSendTo(controller->sdStateUdp, (char*)(&sendMsg), sendMsg.prefix.length + sizeof(SmPrefix), 0,
+				(struct sockaddr *)&controller->udpStateAddr[index], sizeof(struct sockaddr_in));
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// Queue the compact feedback (ROS_STATE_FORMAT_DELTA) to a client, with the
+// controller status (if subscribed) when it changed or with a keyframe
+// return TRUE if the feedback was queued
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_SendFeedbackDelta(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* statusMsg, int statusMsgSize)
+{
+	SimpleMsg sendMsg;
+	StateSendQueue* q = controller->stateSendQ[connectionIndex];
+	int msgSize;
+
+	if(q == NULL)
+		return FALSE;
+
+	msgSize = Ros_StateServer_JointFeedbackDelta(controller, connectionIndex, fbSample, cycle, &sendMsg);
+	if(!Ros_StateServer_QueueMsg(controller, connectionIndex, &sendMsg, msgSize))
+		return FALSE;
+
+	if((controller->stateFieldMask[connectionIndex] & ROS_STATE_FIELD_STATUS) && statusMsgSize > 0 
+		&& (sendMsg.body.jointFeedbackDelta.keyframe || memcmp(&q->deltaStatus, &statusMsg->body.robotStatus, sizeof(SmBodyRobotStatus)) != 0))
+	{
+		Ros_StateServer_QueueMsg(controller, connectionIndex, statusMsg, statusMsgSize);
+		q->deltaStatus = statusMsg->body.robotStatus;
+	}
+
+	return TRUE;
+}
+
+
+//-----------------------------------------------------------------------
+// Creates a message of type: ROS_MSG_MOTO_JOINT_FEEDBACK_DELTA for a client
+// Only the joints of the subscribed groups are sent, as differences with the values of
+// the previous message queued to the client.  A keyframe (absolute values)
+// is sent every FEEDBACK_DELTA_KEYFRAME_PERIOD messages, after a message was
+// dropped, when the valid fields change or when a difference doesn't fit.
+// The reference of the client is updated: the message must be queued.
+//-----------------------------------------------------------------------
+int Ros_StateServer_JointFeedbackDelta(Controller* controller, int connectionIndex, FeedbackSample fbSample[MP_GRP_NUM], UINT32 cycle, SimpleMsg* sendMsg)
+{
+	StateSendQueue* q = controller->stateSendQ[connectionIndex];
+	SmBodyMotoJointFeedbackDelta* body = &sendMsg->body.jointFeedbackDelta;
+	INT32 pos[MOT_MAX_GR][ROS_MAX_JOINT];
+	INT32 vel[MOT_MAX_GR][ROS_MAX_JOINT];
+	INT32 cmdPos[MOT_MAX_GR][ROS_MAX_JOINT];
+	int validFields[MOT_MAX_GR];
+	UCHAR jointMask[MOT_MAX_GR];
+	int groupMask = controller->stateGroupMask[connectionIndex];
+	int fieldMask = controller->stateFieldMask[connectionIndex];
+	int numGroup = min(controller->numGroup, MOT_MAX_GR);
+	BOOL bKeyframe;
+	UINT8* data;
+	int groupNo;
+
+	bKeyframe = (q->deltaKeyframeCnt < 0) || (q->deltaKeyframeCnt >= FEEDBACK_DELTA_KEYFRAME_PERIOD - 1)
+		|| (q->dropCnt != q->deltaDropCnt);
+
+	// Quantize the sample and check if it can be sent as differences
+	for(groupNo = 0; groupNo < numGroup; groupNo++)
+	{
+		if((groupMask & (0x01 << groupNo)) == 0)
+			continue;
+
+		jointMask[groupNo] = Ros_CtrlGroup_GetRosJointConfig(controller->ctrlGroups[groupNo]);
+		validFields[groupNo] = 0;
+
+		if((fieldMask & ROS_STATE_FIELD_POSITION) && fbSample[groupNo].bPosValid)
+		{
+			Ros_StateServer_QuantizeJoints(controller->ctrlGroups[groupNo], fbSample[groupNo].pulsePos, ROS_FEEDBACK_DELTA_POS_SCALE, pos[groupNo]);
+			validFields[groupNo] |= 2;
+			if(!Ros_StateServer_IsDeltaInRange(jointMask[groupNo], pos[groupNo], q->deltaPos[groupNo]))
+				bKeyframe = TRUE;
+		}
+
+		if((fieldMask & ROS_STATE_FIELD_VELOCITY) && fbSample[groupNo].bSpeedValid)
+		{
+			Ros_StateServer_QuantizeJoints(controller->ctrlGroups[groupNo], fbSample[groupNo].pulseSpeed, ROS_FEEDBACK_DELTA_VEL_SCALE, vel[groupNo]);
+			validFields[groupNo] |= 4;
+			if(!Ros_StateServer_IsDeltaInRange(jointMask[groupNo], vel[groupNo], q->deltaVel[groupNo]))
+				bKeyframe = TRUE;
+		}
+
+		if((fieldMask & ROS_STATE_FIELD_COMMAND) && fbSample[groupNo].bCmdPosValid)
+		{
+			Ros_StateServer_QuantizeJoints(controller->ctrlGroups[groupNo], fbSample[groupNo].cmdPulsePos, ROS_FEEDBACK_DELTA_POS_SCALE, cmdPos[groupNo]);
+			validFields[groupNo] |= 32;
+			if(!Ros_StateServer_IsDeltaInRange(jointMask[groupNo], cmdPos[groupNo], q->deltaCmdPos[groupNo]))
+				bKeyframe = TRUE;
+		}
+
+		if(validFields[groupNo] != q->deltaValidFields[groupNo])
+			bKeyframe = TRUE;
+	}
+
+	//initialize memory
+	memset(sendMsg, 0x00, sizeof(SimpleMsg));
+
+	// set header information
+	sendMsg->header.msgType = ROS_MSG_MOTO_JOINT_FEEDBACK_DELTA;
+	sendMsg->header.commType = ROS_COMM_TOPIC;
+	sendMsg->header.replyType = ROS_REPLY_INVALID;
+
+	// set body
+	body->sequence = ++q->deltaSequence;
+	body->cycle = cycle;
+	body->time = fbSample[0].time;
+	body->keyframe = bKeyframe ? 1 : 0;
+
+	data = body->data;
+	for(groupNo = 0; groupNo < numGroup; groupNo++)
+	{
+		if((groupMask & (0x01 << groupNo)) == 0)
+			continue;
+
+		body->numberOfValidGroups++;
+		*data++ = (UINT8)groupNo;
+		*data++ = (UINT8)validFields[groupNo];
+		*data++ = jointMask[groupNo];
+
+		if(validFields[groupNo] & 2)
+			data = Ros_StateServer_PackJoints(data, bKeyframe, jointMask[groupNo], pos[groupNo], q->deltaPos[groupNo]);
+		if(validFields[groupNo] & 4)
+			data = Ros_StateServer_PackJoints(data, bKeyframe, jointMask[groupNo], vel[groupNo], q->deltaVel[groupNo]);
+		if(validFields[groupNo] & 32)
+			data = Ros_StateServer_PackJoints(data, bKeyframe, jointMask[groupNo], cmdPos[groupNo], q->deltaCmdPos[groupNo]);
+
+		q->deltaValidFields[groupNo] = validFields[groupNo];
+	}
+	body->size = (UINT16)(data - body->data);
+
+	q->deltaKeyframeCnt = bKeyframe ? 0 : q->deltaKeyframeCnt + 1;
+	q->deltaDropCnt = q->dropCnt;
+
+	// set prefix: length of message excluding the prefix (only the data used)
+	sendMsg->prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoJointFeedbackDelta) - (ROS_MAX_FEEDBACK_DELTA_DATA - body->size);
+
+	return(sendMsg->prefix.length + sizeof(SmPrefix));
+}
+
+
+//-----------------------------------------------------------------------
+// Convert pulse values to ROS joint values (Base to Tool joint order)
+// in integer units of 1/scale rad (or m)
+//-----------------------------------------------------------------------
+void Ros_StateServer_QuantizeJoints(CtrlGroup* ctrlGroup, long pulseValue[MAX_PULSE_AXES], double scale, INT32 value[ROS_MAX_JOINT])
+{
+	float rosValue[MAX_PULSE_AXES];
+	double scaled;
+	int i;
+
+	memset(value, 0x00, sizeof(INT32) * ROS_MAX_JOINT);
+	Ros_CtrlGroup_ConvertToRosPos(ctrlGroup, pulseValue, rosValue);
+
+	for(i = 0; i < min(ROS_MAX_JOINT, MAX_PULSE_AXES); i++)
+	{
+		scaled = rosValue[i] * scale;
+		value[i] = (INT32)((scaled < 0) ? (scaled - 0.5) : (scaled + 0.5));
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// Check if the differences of the joints with the reference fit an INT16
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_IsDeltaInRange(UCHAR jointMask, INT32 value[ROS_MAX_JOINT], INT32 ref[ROS_MAX_JOINT])
+{
+	int i;
+	INT32 diff;
+
+	for(i = 0; i < min(ROS_MAX_JOINT, MAX_PULSE_AXES); i++)
+	{
+		if((jointMask & (0x01 << i)) == 0)
+			continue;
+
+		diff = value[i] - ref[i];
+		if(diff < -32768 || diff > 32767)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+//-----------------------------------------------------------------------
+// Append the joints of the mask to the message data (absolute INT32 values
+// for a keyframe, otherwise INT16 differences with the reference) and update
+// the reference.  Returns the end of the data.
+//-----------------------------------------------------------------------
+UINT8* Ros_StateServer_PackJoints(UINT8* data, BOOL bKeyframe, UCHAR jointMask, INT32 value[ROS_MAX_JOINT], INT32 ref[ROS_MAX_JOINT])
+{
+	INT16 diff;
+	int i;
+
+	for(i = 0; i < min(ROS_MAX_JOINT, MAX_PULSE_AXES); i++)
+	{
+		if((jointMask & (0x01 << i)) == 0)
+			continue;
+
+		if(bKeyframe)
+		{
+			memcpy(data, &value[i], sizeof(INT32));
+			data += sizeof(INT32);
+		}
+		else
+		{
+			diff = (INT16)(value[i] - ref[i]);
+			memcpy(data, &diff, sizeof(INT16));
+			data += sizeof(INT16);
+		}
+		ref[i] = value[i];
+	}
+
+	return data;
+}
+
+
+//-----------------------------------------------------------------------
+// Queue the status changes detected since the last call
+// (ROS_MSG_MOTO_STATUS_EVENT) to the clients subscribed to the events
+//-----------------------------------------------------------------------
+void Ros_StateServer_SendStatusEvents(Controller* controller)
+{
+	SimpleMsg sendMsg;
+	int index;
+	int msgSize;
+
+	//initialize memory
+	memset(&sendMsg, 0x00, sizeof(SimpleMsg));
+
+	// set prefix: length of message excluding the prefix
+	sendMsg.prefix.length = sizeof(SmHeader) + sizeof(SmBodyMotoStatusEvent);
+	msgSize = sendMsg.prefix.length + sizeof(SmPrefix);
+
+	// set header information
+	sendMsg.header.msgType = ROS_MSG_MOTO_STATUS_EVENT;
+	sendMsg.header.commType = ROS_COMM_TOPIC;
+	sendMsg.header.replyType = ROS_REPLY_INVALID;
+
+	while(Ros_Controller_GetStatusEvent(controller, &sendMsg.body.statusEvent))
+	{
+		for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+		{
+			if(controller->sdStateConnections[index] != INVALID_SOCKET
+				&& (controller->stateFieldMask[index] & ROS_STATE_FIELD_EVENTS))
+				Ros_StateServer_QueueMsg(controller, index, &sendMsg, msgSize);
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------
+// Process ROS_MSG_MOTO_IO_SUBSCRIBE: replace the addresses monitored for
+// a client and start the IO monitor task if needed.
+// return 0 or the invalid subcode of the reply
+//-----------------------------------------------------------------------
+int Ros_StateServer_IOSubscribe(Controller* controller, int connectionIndex, SimpleMsg* receiveMsg, int byteSize)
+{
+	SmBodyMotoIOSubscribe* subscribe = &receiveMsg->body.ioSubscribe;
+	MP_IO_INFO ioAddr[ROS_MAX_IO_SUBSCRIBE];
+	USHORT ioValue[ROS_MAX_IO_SUBSCRIBE];
+	int expectedBytes = sizeof(SmPrefix) + sizeof(SmHeader) + sizeof(int) + sizeof(UINT32);
+	int period;
+	int i;
+
+	// Only the addresses in use are sent
+	if((byteSize < expectedBytes) || (subscribe->numAddresses > ROS_MAX_IO_SUBSCRIBE)
+		|| (byteSize != expectedBytes + (sizeof(UINT32) * subscribe->numAddresses)))
+		return ROS_RESULT_INVALID_MSGSIZE;
+
+	if(subscribe->period < 0 || (subscribe->period > 0 && subscribe->numAddresses == 0))
+		return ROS_RESULT_INVALID_DATA;
+
+	if(subscribe->period == 0)
+	{
+		Ros_StateServer_StopIOSubscription(controller, connectionIndex);
+		return 0;
+	}
+
+	// Check that the addresses can be read (the monitor task ignores read failures)
+	for(i = 0; i < subscribe->numAddresses; i++)
+		ioAddr[i].ulAddr = subscribe->ioAddress[i];
+	if(mpReadIO(ioAddr, ioValue, subscribe->numAddresses) != OK)
+		return ROS_RESULT_INVALID_READIO;
+
+	// Sampled at most once per interpolation period
+	period = max(subscribe->period, controller->interpolPeriod);
+
+	if(mpSemTake(controller->ioSubLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+	{
+		printf("ERROR: Unable to update the IO subscription of state client %d\r\n", connectionIndex);
+		return ROS_RESULT_INVALID_UNSPECIFIED;
+	}
+	memcpy(controller->ioSubAddr[connectionIndex], ioAddr, sizeof(MP_IO_INFO) * subscribe->numAddresses);
+	controller->ioSubNum[connectionIndex] = subscribe->numAddresses;
+	controller->ioSubPeriod[connectionIndex] = period;
+	controller->bIoSubSampled[connectionIndex] = FALSE;
+	controller->ioChangeSent[connectionIndex] = controller->ioChangeCnt[connectionIndex];
+
+	// Start the monitor task if not running (checked under the lock: the task
+	// terminates when it finds no subscription)
+	if(controller->tidIoMonitor == INVALID_TASK)
+	{
+		controller->tidIoMonitor = mpCreateTask(MP_PRI_TIME_NORMAL, MP_STACK_SIZE, 
+									(FUNCPTR)Ros_StateServer_MonitorIO,
+									(int)controller, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	}
+	mpSemGive(controller->ioSubLock);
+
+	if(controller->tidIoMonitor == INVALID_TASK)
+	{
+		printf("Failed to start the IO monitor task\r\n");
+		Ros_StateServer_StopIOSubscription(controller, connectionIndex);
+		return ROS_RESULT_INVALID_UNSPECIFIED;
+	}
+
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------
+// Stop monitoring the IO of a client and discard its pending changes
+//-----------------------------------------------------------------------
+void Ros_StateServer_StopIOSubscription(Controller* controller, int connectionIndex)
+{
+	if(mpSemTake(controller->ioSubLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+	{
+		printf("ERROR: Unable to stop the IO subscription of state client %d\r\n", connectionIndex);
+		return;
+	}
+	controller->ioSubPeriod[connectionIndex] = 0;
+	controller->ioSubNum[connectionIndex] = 0;
+	controller->bIoSubSampled[connectionIndex] = FALSE;
+	controller->ioChangeSent[connectionIndex] = controller->ioChangeCnt[connectionIndex];
+	mpSemGive(controller->ioSubLock);
+}
+
+
+//-----------------------------------------------------------------------
+// Task sampling the IO monitored for the state clients.  Each client is
+// sampled every ioSubPeriod with a single mpReadIO call and the changes
+// are queued for the state server, which is woken up to push them (the
+// wakeup doesn't move its periodic state updates).
+// The samples are scheduled on a fixed grid (the processing time doesn't
+// delay the next sample).  The task terminates when no client is
+// subscribed anymore; the next subscription starts it again.
+//-----------------------------------------------------------------------
+void Ros_StateServer_MonitorIO(Controller* controller)
+{
+	int index;
+	int periodTicks;
+	int sleepTicks;
+	BOOL bSubscribed;
+	BOOL bPosted;
+	ULONG tick;
+
+	printf("Starting IO monitor task\r\n");
+
+	FOREVER
+	{
+		sleepTicks = IO_MONITOR_IDLE_PERIOD / mpGetRtc();
+		bPosted = FALSE;
+
+		if(mpSemTake(controller->ioSubLock, (Q_LOCK_TIMEOUT / mpGetRtc())) == OK)
+		{
+			bSubscribed = FALSE;
+			for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+			{
+				if(controller->ioSubPeriod[index] == 0)
+					continue;
+
+				bSubscribed = TRUE;
+				periodTicks = max(1, controller->ioSubPeriod[index] / mpGetRtc());
+				tick = tickGet();
+				if(!controller->bIoSubSampled[index] || (int)(tick - controller->ioSubLastTick[index]) >= periodTicks)
+				{
+					// Next sample one period after this one was due (restart from now if late by more than a period)
+					if(!controller->bIoSubSampled[index] || (int)(tick - controller->ioSubLastTick[index]) >= 2 * periodTicks)
+						controller->ioSubLastTick[index] = tick;
+					else
+						controller->ioSubLastTick[index] += periodTicks;
+
+					if(Ros_StateServer_SampleIO(controller, index))
+						bPosted = TRUE;
+				}
+				sleepTicks = min(sleepTicks, (int)(controller->ioSubLastTick[index] + periodTicks - tickGet()));
+			}
+
+			if(!bSubscribed)
+			{
+				// Terminate (under the lock so a new subscription starts a new task)
+				controller->tidIoMonitor = INVALID_TASK;
+				mpSemGive(controller->ioSubLock);
+				break;
+			}
+			mpSemGive(controller->ioSubLock);
+		}
+
+		// Wake up the state server: it pushes the changes and goes back to
+		// waiting for its next periodic update (Ros_StateServer_SendState)
+		if(bPosted)
+			mpSemGive(controller->semStatusEvent);
+
+		mpTaskDelay(max(1, sleepTicks));
+	}
+
+	printf("IO monitor task was terminated\r\n");
+	mpDeleteSelf;
+}
+
+
+//-----------------------------------------------------------------------
+// Sample the IO of a client and queue the values that changed
+// (the oldest message is overwritten when the queue is full).
+// Must be called with ioSubLock taken.
+// return TRUE if a change was queued
+//-----------------------------------------------------------------------
+BOOL Ros_StateServer_SampleIO(Controller* controller, int connectionIndex)
+{
+	USHORT ioValue[ROS_MAX_IO_SUBSCRIBE];
+	SmBodyMotoIOChange* ioChange;
+	int num = controller->ioSubNum[connectionIndex];
+	int i;
+
+	if(mpReadIO(controller->ioSubAddr[connectionIndex], ioValue, num) != OK)
+		return FALSE;
+
+	ioChange = &controller->ioChange[connectionIndex][controller->ioChangeCnt[connectionIndex] % IO_CHANGE_QUEUE_SIZE];
+	Ros_Controller_GetTime(&ioChange->time);
+	ioChange->numChanges = 0;
+	for(i = 0; i < num; i++)
+	{
+		if(!controller->bIoSubSampled[connectionIndex] || ioValue[i] != controller->ioSubValue[connectionIndex][i])
+		{
+			ioChange->change[ioChange->numChanges].ioAddress = controller->ioSubAddr[connectionIndex][i].ulAddr;
+			ioChange->change[ioChange->numChanges].ioValue = ioValue[i];
+			ioChange->numChanges++;
+		}
+		controller->ioSubValue[connectionIndex][i] = ioValue[i];
+	}
+	controller->bIoSubSampled[connectionIndex] = TRUE;
+
+	if(ioChange->numChanges == 0)
+		return FALSE;
+
+	ioChange->sequence = controller->ioChangeCnt[connectionIndex] + 1;
+	controller->ioChangeCnt[connectionIndex]++;
+	return TRUE;
+}
+
+
+//-----------------------------------------------------------------------
+// Queue the IO changes sampled since the last call (ROS_MSG_MOTO_IO_CHANGE)
+// to the clients that subscribed to them
+//-----------------------------------------------------------------------
+void Ros_StateServer_SendIOChanges(Controller* controller)
+{
+	SimpleMsg sendMsg;
+	int index;
+	BOOL bNewChange;
+
+	//initialize memory
+	memset(&sendMsg, 0x00, sizeof(SimpleMsg));
+
+	// set header information
+	sendMsg.header.msgType = ROS_MSG_MOTO_IO_CHANGE;
+	sendMsg.header.commType = ROS_COMM_TOPIC;
+	sendMsg.header.replyType = ROS_REPLY_INVALID;
+
+	for(index = 0; index < MAX_STATE_CONNECTIONS; index++)
+	{
+		if(controller->sdStateConnections[index] == INVALID_SOCKET)
+			continue;
+
+		do
+		{
+			if(mpSemTake(controller->ioSubLock, (Q_LOCK_TIMEOUT / mpGetRtc())) != OK)
+				return;
+
+			bNewChange = (controller->ioChangeSent[index] != controller->ioChangeCnt[index]);
+			if(bNewChange)
+			{
+				// Skip the changes that were overwritten (the client sees a gap in the sequence)
+				if(controller->ioChangeCnt[index] - controller->ioChangeSent[index] > IO_CHANGE_QUEUE_SIZE)
+					controller->ioChangeSent[index] = controller->ioChangeCnt[index] - IO_CHANGE_QUEUE_SIZE;
+
+				sendMsg.body.ioChange = controller->ioChange[index][controller->ioChangeSent[index] % IO_CHANGE_QUEUE_SIZE];
+				controller->ioChangeSent[index]++;
+			}
+
+			mpSemGive(controller->ioSubLock);
+
+			if(bNewChange)
+			{
+				// set prefix: length of message excluding the prefix (only the changes are sent)
+				sendMsg.prefix.length = sizeof(SmHeader) + (sizeof(SmBodyMotoIOChange) - sizeof(sendMsg.body.ioChange.change))
+					+ (sizeof(SmIOListEntry) * sendMsg.body.ioChange.numChanges);
+				Ros_StateServer_QueueMsg(controller, index, &sendMsg, sendMsg.prefix.length + sizeof(SmPrefix));
+			}
+		} while(bNewChange);
+	}
 }
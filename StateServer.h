@@ -35,7 +35,12 @@
 #include "Controller.h"
 
 #define STATE_UPDATE_MIN_PERIOD 25   // Time delay between each state update
+#define STATE_SEND_STALL_TIMEOUT 2000 // Time (ms) a client can stop reading its messages before being disconnected
+#define UDP_STATE_CLIENT_TIMEOUT 5000 // Time (ms) a UDP client stays registered without renewing its subscription
+#define FEEDBACK_DELTA_KEYFRAME_PERIOD 100 // Number of compact feedback messages between two keyframes
+#define IO_MONITOR_IDLE_PERIOD 100 // Maximum time (ms) between two checks of the IO monitor task (retry when the subscriptions are locked)
 
-extern void Ros_StateServer_StartNewConnection(Controller* controller, int sd);
+extern void Ros_StateServer_StartNewConnection(Controller* controller, int sd, ULONG clientAddr);
+extern void Ros_StateServer_ReceiveUdpMsg(Controller* controller);
 
 #endif